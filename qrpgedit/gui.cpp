@@ -31,6 +31,7 @@
 #include "rpgengine.h"
 #include "propertyeditor.h"
 #include "mapbox.h"
+#include "mapundo.h"
 
 MainWindow::MainWindow() :
   QMainWindow() {
@@ -99,6 +100,20 @@ MainWindow::MainWindow() :
 
   // Edit menu
 
+  undoAction = editMenu->addAction("&Undo");
+  undoAction->setShortcuts(QKeySequence::Undo);
+  undoAction->setEnabled(false);
+  connect(undoAction, SIGNAL(triggered()), this, SLOT(undo()));
+  connect(MapUndo::getStack(), SIGNAL(canUndoChanged(bool)), undoAction, SLOT(setEnabled(bool)));
+
+  redoAction = editMenu->addAction("&Redo");
+  redoAction->setShortcuts(QKeySequence::Redo);
+  redoAction->setEnabled(false);
+  connect(redoAction, SIGNAL(triggered()), this, SLOT(redo()));
+  connect(MapUndo::getStack(), SIGNAL(canRedoChanged(bool)), redoAction, SLOT(setEnabled(bool)));
+
+  editMenu->addSeparator();
+
   cutAction = editMenu->addAction("Cu&t");
   cutAction->setShortcut(QKeySequence("Ctrl+X"));
   connect(cutAction, SIGNAL(triggered()), mapBox->mapScene, SLOT(cutSelection()));
@@ -379,7 +394,7 @@ void MainWindow::resourceDoubleClicked(QTreeWidgetItem * item, int column) {
 
 void MainWindow::showNewLayerDialog(int before) {
   if(newlayerdialog->exec() == QDialog::Accepted ) {
-    mapwin->mapbox->getMap()->insertLayerBefore(before, newlayerdialog->xspin->value(),
+    MapUndo::insertLayer(mapwin->mapbox->getMap(), before, newlayerdialog->xspin->value(),
 			newlayerdialog->yspin->value(),
 			newlayerdialog->wrapcheck->isChecked(),
       tiles->getTile(),
@@ -390,11 +405,33 @@ void MainWindow::showNewLayerDialog(int before) {
 }
 
 void MainWindow::deleteLayer(int layer) {
-  if(QMessageBox::warning(this, "Delete Layer?", 
-    "Deleting a layer cannot be undone.  Proceed?",
-    QMessageBox::Ok|QMessageBox::Cancel, QMessageBox::Cancel) == QMessageBox::Ok)
-    mapwin->mapbox->deleteLayer(layer);
+  mapwin->mapbox->deleteLayer(layer);
+  emit updateLayers();
+}
+
+void MainWindow::undo() {
+  if(play) return;
+  mapBox->mapScene->commitSelection();
+  MapUndo::undo();
+  undoFinished();
+}
+
+void MainWindow::redo() {
+  if(play) return;
+  mapBox->mapScene->commitSelection();
+  MapUndo::getStack()->redo();
+  undoFinished();
+}
+
+// Layer commands may have changed the layer count under the map box.
+void MainWindow::undoFinished() {
+  Map * map = mapBox->getMap();
+  if(map && !mapBox->getCurrentLayer())
+    mapBox->setLayer(map->getLayerCount() - 1);
+  // The stack can't tell that an expired tile edit ends the history.
+  undoAction->setEnabled(MapUndo::canUndo());
   emit updateLayers();
+  mapBox->requestRepaint();
 }
 
 void MainWindow::loadProject() {
@@ -539,6 +576,7 @@ void MainWindow::updateProjectTitle(QString projtitle) {
 void MainWindow::showEntityDialog(EntityPointer x) {
   EntityDialog d(x);
   d.exec();
+  mapBox->requestRepaint();
 }
 
 void MainWindow::showMapScriptDialog(Map * x) {
@@ -549,6 +587,7 @@ void MainWindow::showMapScriptDialog(Map * x) {
 void MainWindow::showPropertyEditor(ObjectPointer x) {
   PropertyEditor d(x);
   d.exec();
+  mapBox->requestRepaint();
 }
 
 void MainWindow::showGlobalScriptDialog() {
@@ -581,18 +620,22 @@ void MainWindow::updateMousePos(int x, int y, int tx, int ty) {
 
 void MainWindow::setViewTilePos(bool b) {
   viewTilePos = b;
+  mapBox->requestRepaint();
 }
 
 void MainWindow::setViewEntityNames(bool b) {
   viewEntityNames = b;
+  mapBox->requestRepaint();
 }
 
 void MainWindow::setViewGrid(bool b) {
   viewGrid = b;
+  mapBox->requestRepaint();
 }
 
 void MainWindow::setViewBoundingBoxes(bool b) {
   viewBoundingBoxes = b;
+  mapBox->requestRepaint();
 }
 
 void MainWindow::setPaintModeBrush(bool b) {
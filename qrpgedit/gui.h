@@ -49,6 +49,8 @@ public slots:
   void showMapScriptDialog(Map *);
   void showGlobalScriptDialog();
   void deleteLayer(int);
+  void undo();
+  void redo();
   void resourceSelected();
   void resourceClicked(QTreeWidgetItem *, int);
   void resourceDoubleClicked(QTreeWidgetItem *, int);
@@ -98,6 +100,8 @@ signals:
   void updateMapStatus(QString);
 
 private:
+  void undoFinished();
+
   // Map window
   MapWindow * mapwin;
 
@@ -154,6 +158,8 @@ private:
   QAction * paintFillAction;
   QAction * paintSelectBoxAction;
 
+  QAction * undoAction;
+  QAction * redoAction;
   QAction * cutAction;
   QAction * copyAction;
   QAction * pasteAction;
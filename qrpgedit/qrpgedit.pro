@@ -65,7 +65,23 @@ SOURCES +=\
     ../qrpglib/bitmap_qt.cpp \
     ../qrpglib/propertyeditor.cpp \
     ../qrpglib/layerdialog.cpp \
-    ../qrpglib/mapreadertiled.cpp
+    ../qrpglib/mapreadertiled.cpp \
+    ../qrpglib/tilebatch.cpp \
+    ../qrpglib/textureatlas.cpp \
+    ../qrpglib/gameloop.cpp \
+    ../qrpglib/entitygrid.cpp \
+    ../qrpglib/triggerindex.cpp \
+    ../qrpglib/tiledataparser.cpp \
+    ../qrpglib/binarymap.cpp \
+    ../qrpglib/mapcache.cpp \
+    ../qrpglib/mappreloader.cpp \
+    ../qrpglib/textureresidency.cpp \
+    ../qrpglib/tileops.cpp \
+    ../qrpglib/sparsetiles.cpp \
+    ../qrpglib/mapundo.cpp \
+    ../qrpglib/profiler.cpp \
+    ../qrpglib/trace.cpp \
+    ../qrpglib/benchmark.cpp
 
 HEADERS  += \
     gui.h \
@@ -116,7 +132,23 @@ HEADERS  += \
     ../qrpglib/bitmap.h \
     ../qrpglib/propertyeditor.h \
     ../qrpglib/layerdialog.h \
-    ../qrpglib/mapreadertiled.h
+    ../qrpglib/mapreadertiled.h \
+    ../qrpglib/tilebatch.h \
+    ../qrpglib/textureatlas.h \
+    ../qrpglib/gameloop.h \
+    ../qrpglib/entitygrid.h \
+    ../qrpglib/triggerindex.h \
+    ../qrpglib/tiledataparser.h \
+    ../qrpglib/binarymap.h \
+    ../qrpglib/mapcache.h \
+    ../qrpglib/mappreloader.h \
+    ../qrpglib/textureresidency.h \
+    ../qrpglib/tileops.h \
+    ../qrpglib/sparsetiles.h \
+    ../qrpglib/mapundo.h \
+    ../qrpglib/profiler.h \
+    ../qrpglib/trace.h \
+    ../qrpglib/benchmark.h
 
 FORMS    +=
 
@@ -15,9 +15,15 @@
 #include "projectreader.h"
 #include "scriptutils.h"
 #include "qmlutils.h"
+#include "gameloop.h"
+#include "map.h"
+#include "binarymap.h"
+#include "trace.h"
 
 // for testing
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 
 /*
 #ifdef _MSC_VER
@@ -34,24 +40,62 @@ int main(int argc, char *argv[]) {
 #endif
   qputenv("QML_ENABLE_TEXT_IMAGE_CACHE", "true");
 
+  // --headless runs the game logic without a window, GL context or sound
+  // device.  It has to be known before QApplication connects to a display.
   is_editor = false;
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "--headless")) headless = true;
+  }
+
+  if(!headless) {
 #if QT_VERSION < 0x050000
-  QGL::setPreferredPaintEngine(QPaintEngine::OpenGL2);
+    QGL::setPreferredPaintEngine(QPaintEngine::OpenGL2);
 #endif
-  QApplication::setGraphicsSystem("opengl");
-  QApplication mapedit(argc, argv);
-  mainGLWidget = new QGLWidget();
-  EngineWindow mainwindow;
-
-  mapBox = mainwindow.mapBox;
-  declarativeEngine = mapBox->engine();
+    QApplication::setGraphicsSystem("opengl");
+  }
+  QApplication mapedit(argc, argv, !headless);
+  EngineWindow * mainwindow = 0;
+  if(headless) {
+    declarativeEngine = new QDeclarativeEngine;
+  } else {
+    // Sync buffer swaps to the display; GameLoop adds its own FPS cap on top.
+    QGLFormat glFormat;
+    glFormat.setSwapInterval(1);
+    mainGLWidget = new QGLWidget(glFormat);
+    mainwindow = new EngineWindow;
+
+    mapBox = mainwindow->mapBox;
+    declarativeEngine = mapBox->engine();
+  }
   initScriptEngine();
 
-  RPGEngine::init();
+  // --convert-maps writes a .bmap next to every .xmap of the project,
+  // --export-xmaps writes the loaded maps (binary or not) back as .xmap.
+  // --trace=SECONDS records a Chrome trace from startup, into the file
+  // given by --trace-file=FILE (trace.json in the project directory if not).
+  // --steps=N is how many simulation steps --headless runs before exiting.
+  QStringList args = mapedit.arguments();
+  bool convertMaps = args.contains("--convert-maps");
+  bool exportXmaps = args.contains("--export-xmaps");
+  QString projectFile = "Tech Demo 2/Tech Demo 2.xproj";
+  int traceSeconds = -1;
+  QString traceFile;
+  int headlessSteps = 3600;
+  for(int i = 1; i < args.size(); i++) {
+    if(args[i].startsWith("--steps=")) headlessSteps = args[i].mid(8).toInt();
+    else if(args[i].startsWith("--trace=")) traceSeconds = args[i].mid(8).toInt();
+    else if(args[i].startsWith("--trace-file="))
+      traceFile = QFileInfo(args[i].mid(13)).absoluteFilePath();
+    else if(!args[i].startsWith("--")) projectFile = args[i];
+  }
+
+  if(!convertMaps && !exportXmaps)
+    RPGEngine::init();
   //mainGLWidget = new QGLWidget;
   play = true;
 
-  QTreeWidget * resources = new QTreeWidget;
+  // The resource folders are plain items; headless they have no tree.
+  QTreeWidget * resources = headless ? 0 : new QTreeWidget;
   bitmapfolder = new Resource(Resource::Folder, 0, "Tilesets", resources);
   mapfolder = new Resource(Resource::Folder, 0, "Maps", resources);
   spritefolder = new Resource(Resource::Folder, 0, "Sprites", resources);
@@ -61,23 +105,49 @@ int main(int argc, char *argv[]) {
   ProjectReader projectReader;
   Project * loadedProject;
   //int id = QFontDatabase::addApplicationFont("PfennigBold.otf");
-  QFontDatabase::addApplicationFont("PfennigBold.otf");
-  talkBoxBackground = new QPixmap("ui.png");
+  if(!headless) {
+    QFontDatabase::addApplicationFont("PfennigBold.otf");
+    talkBoxBackground = new QPixmap("ui.png");
+  }
 
-  if(!QDir::setCurrent("Tech Demo 2")) {
+  QFileInfo projectInfo(projectFile);
+  if(!QDir::setCurrent(projectInfo.path())) {
     message("Could not change directory!\n" + QDir::currentPath());
     return 1;
   }
 
   QString currentDir = QDir::currentPath();
 
-  loadedProject = projectReader.read("Tech Demo 2.xproj");
+  loadedProject = projectReader.read(projectInfo.fileName());
 
   QDir::setCurrent(currentDir);
 
-  mainwindow.resize(1024, 768);
-  mainwindow.show();
-  mapBox->setDrawMode(LayerView::AllOpaque);
+  if(convertMaps || exportXmaps) {
+    QList < QPair < Map *, QString > > mapFiles = projectReader.getMapFiles();
+    bool ok = true;
+    for(int i = 0; i < mapFiles.size(); i++) {
+      QFileInfo xmap(mapFiles[i].second);
+      if(convertMaps) {
+        QString bmap = xmap.path() + "/" + xmap.completeBaseName() + ".bmap";
+        if(BinaryMap::write(mapFiles[i].first, bmap)) {
+          printf("%s -> %s\n", xmap.filePath().toLocal8Bit().data(), bmap.toLocal8Bit().data());
+        } else {
+          printf("%s: %s\n", bmap.toLocal8Bit().data(), BinaryMap::errorString().toLocal8Bit().data());
+          ok = false;
+        }
+      } else {
+        mapFiles[i].first->save(xmap.filePath());
+        printf("%s\n", xmap.filePath().toLocal8Bit().data());
+      }
+    }
+    return ok ? 0 : 1;
+  }
+
+  if(!headless) {
+    mainwindow->resize(1024, 768);
+    mainwindow->show();
+    mapBox->setDrawMode(LayerView::AllOpaque);
+  }
 
   /*
   mapBox->setMap(0);
@@ -113,6 +183,8 @@ int main(int argc, char *argv[]) {
   qmlUtils = new QmlUtils;
   declarativeEngine->rootContext()->setContextProperty("utils", qmlUtils);
 
+  if(traceSeconds >= 0) Trace::start(traceSeconds, traceFile);
+
   //bool dirExists = QDir::setCurrent("scripts");
   scriptUtils->include("scripts/init.js");
   //if(dirExists) QDir::setCurrent("..");
@@ -120,8 +192,19 @@ int main(int argc, char *argv[]) {
   apptime.start();
   fpstime.start();
   timeLastFrame = apptime.elapsed();
+  gameLoop = new GameLoop;
+  if(headless) {
+    int result = gameLoop->runHeadless(headlessSteps);
+    Trace::stop();
+    return result;
+  }
+  gameLoop->start();
   mapedit.exec();
 
+  // A trace still running when the window closes is written out anyway.
+  Trace::stop();
+  delete mainwindow;
+
 #ifdef _MSC_VER
   //_CrtDumpMemoryLeaks();
 #endif
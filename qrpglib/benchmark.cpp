@@ -0,0 +1,181 @@
+#include <QtCore>
+#include <QtScript>
+#include "benchmark.h"
+#include "npc.h"
+#include "map.h"
+#include "mapreader.h"
+#include "profiler.h"
+#include "globals.h"
+
+static const char * npcScript =
+  "var d = this.x * 0.5 + this.y;\n"
+  "if(d < 0) this.x = 0;\n";
+
+QString Benchmark::scripts(int count, int frames) {
+  QList < EntityPointer > npcs = makeNpcs(count);
+  for(int i = 0; i < npcs.size(); i++) {
+    npcs[i]->addScript(ScriptCondition::EveryFrame, npcScript);
+  }
+  Profiler::startClock();
+
+  // Before: every script parsed from its source each time it runs.
+  QString source(npcScript);
+  qint64 start = Profiler::now();
+  for(int f = 0; f < frames; f++) {
+    for(int i = 0; i < npcs.size(); i++) {
+      QScriptContext * context = scriptEngine->pushContext();
+      context->setThisObject(npcs[i]->getScriptObject());
+      scriptEngine->evaluate(source);
+      scriptEngine->popContext();
+    }
+  }
+  qint64 before = Profiler::now() - start;
+
+  // After: Entity::update, which runs the compiled program.
+  start = Profiler::now();
+  for(int f = 0; f < frames; f++) {
+    for(int i = 0; i < npcs.size(); i++) npcs[i]->update();
+  }
+  qint64 after = Profiler::now() - start;
+
+  dropNpcs(npcs);
+  frames = qMax(frames, 1);
+  return finish(QString("entity scripts, %1 NPC(s) over %2 frame(s): "
+                        "%3 ms/frame from source, %4 ms/frame compiled")
+    .arg(count).arg(frames)
+    .arg(before / 1e6 / frames, 0, 'f', 3)
+    .arg(after / 1e6 / frames, 0, 'f', 3));
+}
+
+QString Benchmark::mapLoad(int size, int layers) {
+  QByteArray xml;
+  xml.reserve(layers * size * size * 5 + 1024);
+  xml += "<map>\n";
+  for(int l = 0; l < layers; l++) {
+    xml += "  <layer>\n    <width>" + QByteArray::number(size) + "</width>\n"
+           "    <height>" + QByteArray::number(size) + "</height>\n"
+           "    <layerdata>\n";
+    for(int y = 0; y < size; y++) {
+      xml += "      ";
+      for(int x = 0; x < size; x++) {
+        xml += QByteArray::number(qrand() % 256);
+        xml += ' ';
+      }
+      xml += '\n';
+    }
+    xml += "    </layerdata>\n  </layer>\n";
+  }
+  xml += "</map>\n";
+
+  // The new map registers itself as "Unnamed Map"; put back any map that
+  // already had that name once it is gone.
+  int unnamed = mapnames.value("Unnamed Map", -1);
+
+  QBuffer buffer(&xml);
+  buffer.open(QIODevice::ReadOnly);
+  MapReader reader;
+  Profiler::startClock();
+  qint64 start = Profiler::now();
+  bool ok = reader.parse(&buffer);
+  qint64 parsed = Profiler::now();
+  Map * map = ok ? reader.create() : 0;
+  qint64 created = Profiler::now();
+
+  if(map) {
+    maps.removeOne(map);
+    mapnames.remove(map->getName());
+    delete map->getThisMap();
+    delete map;
+  }
+  if(unnamed >= 0) mapnames["Unnamed Map"] = unnamed;
+
+  if(!map) return finish("map load benchmark: the generated map did not load");
+  return finish(QString("map load, %1 layer(s) of %2x%2 (%3 MB of XML): "
+                        "%4 ms parse, %5 ms create")
+    .arg(layers).arg(size).arg(xml.size() / 1048576.0, 0, 'f', 1)
+    .arg((parsed - start) / 1e6, 0, 'f', 1)
+    .arg((created - parsed) / 1e6, 0, 'f', 1));
+}
+
+static bool yOrder(EntityPointer a, EntityPointer b) {
+  return a->getY() < b->getY();
+}
+
+QString Benchmark::depthSort(int count, int frames) {
+  QList < EntityPointer > npcs = makeNpcs(count);
+  for(int i = 0; i < npcs.size(); i++) {
+    npcs[i]->setPos(qrand() % 4096, qrand() % 4096);
+  }
+  qSort(npcs.begin(), npcs.end(), yOrder);
+  QList < QPointF > startPos;
+  for(int i = 0; i < npcs.size(); i++) {
+    startPos.append(QPointF(npcs[i]->getX(), npcs[i]->getY()));
+  }
+  uint seed = qrand();
+  Profiler::startClock();
+
+  // Both runs see the same moves from the same sorted start.
+  QList < EntityPointer > list = npcs;
+  qint64 before = 0;
+  for(int f = 0; f < frames; f++) {
+    moveSome(npcs, seed, f);
+    qint64 start = Profiler::now();
+    qSort(list.begin(), list.end(), yOrder);
+    before += Profiler::now() - start;
+  }
+
+  for(int i = 0; i < npcs.size(); i++) {
+    npcs[i]->setPos(startPos[i].x(), startPos[i].y());
+  }
+  list = npcs;
+  Map::Layer layer;
+  qint64 after = 0;
+  for(int f = 0; f < frames; f++) {
+    moveSome(npcs, seed, f);
+    qint64 start = Profiler::now();
+    layer.sortEntities(list);
+    after += Profiler::now() - start;
+  }
+
+  dropNpcs(npcs);
+  frames = qMax(frames, 1);
+  return finish(QString("depth sort, %1 entities over %2 frame(s): "
+                        "%3 ms/frame with qSort, %4 ms/frame incremental")
+    .arg(count).arg(frames)
+    .arg(before / 1e6 / frames, 0, 'f', 3)
+    .arg(after / 1e6 / frames, 0, 'f', 3));
+}
+
+// Nudges a tenth of the entities up or down by a few pixels, the same ones
+// by the same amounts for a given seed and frame.
+void Benchmark::moveSome(QList < EntityPointer > & list, uint seed, int frame) {
+  qsrand(seed + frame);
+  for(int i = 0; i < list.size() / 10; i++) {
+    EntityPointer e = list[qrand() % list.size()];
+    e->setPos(e->getX(), e->getY() + qrand() % 9 - 4);
+  }
+}
+
+// NPCs that are on no map, under names nothing else uses.
+QList < EntityPointer > Benchmark::makeNpcs(int count) {
+  QList < EntityPointer > npcs;
+  for(int i = 0; i < count; i++) {
+    QString name = QString("benchmark %1").arg(i);
+    while(staticEntityNames.contains(name)) name += "'";
+    npcs.append((new Npc(name))->getSharedPointer());
+  }
+  return npcs;
+}
+
+void Benchmark::dropNpcs(QList < EntityPointer > & npcs) {
+  for(int i = 0; i < npcs.size(); i++) {
+    npcs[i]->destroy();
+    staticEntityNames.remove(npcs[i]->getName());
+  }
+  npcs.clear();
+}
+
+QString Benchmark::finish(const QString & report) {
+  cprint(report);
+  return report;
+}
@@ -0,0 +1,31 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H 1
+
+#include <QtCore>
+#include "entity.h"
+
+/* Timings for the engine's hot paths on generated data, so they can be
+   compared before and after a change without a project that happens to
+   stress them.  Each returns a short report, which is also printed on the
+   console; they are reached through rpgx. */
+
+class Benchmark {
+public:
+  // Per-frame cost of an EveryFrame script on count NPCs, evaluated from
+  // source as before scripts were compiled, and run from the cached program.
+  static QString scripts(int count, int frames);
+  // Parse and create times for a map of layers size x size layers,
+  // generated in memory in the format Map::save writes.
+  static QString mapLoad(int size, int layers);
+  // Depth sorting count entities with a tenth of them moving each frame,
+  // by qSort on shared pointers as before and by Layer::sortEntities.
+  static QString depthSort(int count, int frames);
+
+private:
+  static void moveSome(QList < EntityPointer > & list, uint seed, int frame);
+  static QList < EntityPointer > makeNpcs(int count);
+  static void dropNpcs(QList < EntityPointer > & npcs);
+  static QString finish(const QString & report);
+};
+
+#endif
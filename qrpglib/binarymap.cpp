@@ -0,0 +1,317 @@
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include <QtCore>
+#include <QtEndian>
+#include <string.h>
+#include "binarymap.h"
+#include "map.h"
+#include "bitmap.h"
+#include "sprite.h"
+#include "entity.h"
+#include "npc.h"
+#include "globals.h"
+
+QString BinaryMap::error;
+
+static const char magic[4] = { 'O', 'E', 'B', 'M' };
+
+static void putU32(QByteArray & b, quint32 offset, quint32 v) {
+  qToLittleEndian(v, (uchar *) b.data() + offset);
+}
+
+static quint32 getU32(const uchar * base, quint32 offset) {
+  return qFromLittleEndian<quint32>(base + offset);
+}
+
+bool BinaryMap::write(Map * map, QString filename) {
+  int i;
+  map->load();
+  int layers = map->getLayerCount();
+
+  // Layer names come first, after the header and layer table.
+  QList < QByteArray > names;
+  quint32 offset = HeaderSize + LayerEntrySize * layers;
+  quint32 namesOffset = offset;
+  for(i = 0; i < layers; i++) {
+    names.append(map->getLayerName(i).toUtf8());
+    offset += names[i].size();
+  }
+
+  QList < quint32 > dataOffsets;
+  for(i = 0; i < layers; i++) {
+    Map::Layer * l = map->getLayer(i);
+    offset = align(offset);
+    dataOffsets.append(offset);
+    offset += l->width * l->height * 4;
+  }
+
+  // Entities and scripts.
+  QByteArray meta;
+  QDataStream out(&meta, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_4_6);
+
+  out << map->getName();
+  out << (map->getTileset() ? map->getTileset()->getName() : QString());
+  out << (qint32) map->getScriptCount();
+  for(i = 0; i < map->getScriptCount(); i++) {
+    out << (qint32) map->getScriptCondition(i) << map->getScript(i);
+  }
+
+  for(i = 0; i < layers; i++) {
+    out << (qint32) map->getStartEntityCount(i);
+    for(int j = 0; j < map->getStartEntityCount(i); j++) {
+      EntityPointer e = map->getStartEntity(i, j);
+      int bx1, by1, bx2, by2;
+      e->getStoredBoundingBox(bx1, by1, bx2, by2);
+
+      out << e->getName();
+      out << (e->getSprite() ? e->getSprite()->getName() : QString());
+      out << e->getX() << e->getY();
+      out << (qint32) e->getState();
+      out << (qint32) bx1 << (qint32) by1 << (qint32) bx2 << (qint32) by2;
+      out << e->getOverrideBoundingBox() << e->isInvisible() << e->isSolid();
+
+      out << (qint32) e->getScriptCount();
+      for(int k = 0; k < e->getScriptCount(); k++) {
+        int x1, y1, x2, y2;
+        e->getScriptBoundingBox(k, x1, y1, x2, y2);
+        out << (qint32) e->getScriptCondition(k) << e->getScript(k);
+        out << e->usesDefaultBounds(k);
+        out << (qint32) x1 << (qint32) y1 << (qint32) x2 << (qint32) y2;
+      }
+    }
+  }
+
+  quint32 metaOffset = align(offset);
+
+  QByteArray file(metaOffset + meta.size(), 0);
+  memcpy(file.data(), magic, 4);
+  putU32(file, 4, Version);
+  putU32(file, 8, layers);
+  putU32(file, 12, HeaderSize);
+  putU32(file, 16, metaOffset);
+  putU32(file, 20, meta.size());
+
+  offset = namesOffset;
+  for(i = 0; i < layers; i++) {
+    Map::Layer * l = map->getLayer(i);
+    quint32 entry = HeaderSize + LayerEntrySize * i;
+    putU32(file, entry, l->width);
+    putU32(file, entry + 4, l->height);
+    putU32(file, entry + 8, dataOffsets[i]);
+    putU32(file, entry + 12, offset);
+    putU32(file, entry + 16, names[i].size());
+
+    memcpy(file.data() + offset, names[i].constData(), names[i].size());
+    offset += names[i].size();
+
+    uchar * tiles = (uchar *) file.data() + dataOffsets[i];
+    for(int y = 0; y < l->height; y++) {
+      for(int x = 0; x < l->width; x++) {
+        qToLittleEndian((qint32) l->tileAt(x, y), tiles + (x + y * l->width) * 4);
+      }
+    }
+  }
+
+  memcpy(file.data() + metaOffset, meta.constData(), meta.size());
+
+  map->releaseMappedFile(filename);
+
+  QFile f(filename);
+  if(!f.open(QIODevice::WriteOnly))
+    return fail(QObject::tr("could not open file for writing"));
+  if(f.write(file) != file.size())
+    return fail(QObject::tr("could not write file"));
+
+  return true;
+}
+
+Map * BinaryMap::read(QString filename, Map * into) {
+  int i;
+  QFile * f = new QFile(filename);
+
+  if(!f->open(QIODevice::ReadOnly)) {
+    delete f;
+    fail(QObject::tr("could not open file"));
+    return 0;
+  }
+
+  quint32 size = f->size();
+  const uchar * base = f->map(0, size);
+  if(!base || size < HeaderSize || memcmp(base, magic, 4) != 0) {
+    delete f;
+    fail(QObject::tr("not a binary map file"));
+    return 0;
+  }
+
+  quint32 version = getU32(base, 4);
+  quint32 layers = getU32(base, 8);
+  quint32 tableOffset = getU32(base, 12);
+  quint32 metaOffset = getU32(base, 16);
+  quint32 metaSize = getU32(base, 20);
+
+  if(version != Version) {
+    delete f;
+    fail(QObject::tr("unsupported version %1").arg(version));
+    return 0;
+  }
+  if(tableOffset + (quint64) layers * LayerEntrySize > size ||
+     (quint64) metaOffset + metaSize > size) {
+    delete f;
+    fail(QObject::tr("file is truncated"));
+    return 0;
+  }
+
+  // Check every layer before creating anything.
+  for(i = 0; i < (int) layers; i++) {
+    quint32 entry = tableOffset + LayerEntrySize * i;
+    quint64 tiles = (quint64) getU32(base, entry) * getU32(base, entry + 4);
+    if(getU32(base, entry + 8) + tiles * 4 > size ||
+       (quint64) getU32(base, entry + 12) + getU32(base, entry + 16) > size ||
+       getU32(base, entry + 8) % 4 != 0) {
+      delete f;
+      fail(QObject::tr("layer %1 is truncated").arg(i));
+      return 0;
+    }
+  }
+
+  QByteArray metaBytes = QByteArray::fromRawData((const char *) base + metaOffset, metaSize);
+  QDataStream in(metaBytes);
+  in.setVersion(QDataStream::Qt_4_6);
+
+  QString mapName, tilesetName;
+  qint32 scriptCount;
+  in >> mapName >> tilesetName >> scriptCount;
+
+  Map * map = into ? into : new Map();
+  map->setName(mapName);
+  map->setTileset(bitmaps[bitmapnames[tilesetName]]);
+
+  for(i = 0; i < scriptCount && in.status() == QDataStream::Ok; i++) {
+    qint32 condition;
+    QString script;
+    in >> condition >> script;
+    map->addScript(condition, script);
+  }
+
+  bool mapped = false;
+  for(i = 0; i < (int) layers; i++) {
+    quint32 entry = tableOffset + LayerEntrySize * i;
+    int w = getU32(base, entry);
+    int h = getU32(base, entry + 4);
+    const uchar * tiles = base + getU32(base, entry + 8);
+    QString name = QString::fromUtf8((const char *) base + getU32(base, entry + 12),
+                                     getU32(base, entry + 16));
+
+    int layer;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    layer = map->addMappedLayer(w, h, (int *) tiles, name);
+    mapped = true;
+#else
+    layer = map->addLayer(w, h, false, 0, name);
+    for(int t = 0; t < w * h; t++) {
+      map->getLayer(layer)->layerdata[t] = qFromLittleEndian<qint32>(tiles + t * 4);
+    }
+#endif
+
+    qint32 entityCount = 0;
+    in >> entityCount;
+    for(int j = 0; j < entityCount && in.status() == QDataStream::Ok; j++) {
+      QString ename, sprite;
+      double x, y;
+      qint32 state, bx1, by1, bx2, by2, entityScripts;
+      bool overrideBoundingBox, invisible, solid;
+
+      in >> ename >> sprite >> x >> y >> state;
+      in >> bx1 >> by1 >> bx2 >> by2;
+      in >> overrideBoundingBox >> invisible >> solid;
+
+      // Same setup as MapReader::readEntity.
+      Entity * ePtr = new Npc(ename);
+      EntityPointer e = ePtr->getSharedPointer();
+      if(sprite != "")
+        e->setSprite(sprite);
+      else
+        e->setSprite(0);
+      e->setPos(x, y);
+      e->setState(state);
+      e->setBoundingBox(bx1, by1, bx2, by2);
+      e->setOverrideBoundingBox(overrideBoundingBox);
+      e->setInvisible(invisible);
+      e->setSolid(solid);
+
+      in >> entityScripts;
+      for(int k = 0; k < entityScripts && in.status() == QDataStream::Ok; k++) {
+        qint32 condition, x1, y1, x2, y2;
+        QString script;
+        bool defCoords;
+        in >> condition >> script >> defCoords >> x1 >> y1 >> x2 >> y2;
+        e->addScript(condition, script, defCoords, x1, y1, x2, y2);
+      }
+
+      map->addStartEntity(layer, e);
+    }
+  }
+
+  if(in.status() != QDataStream::Ok) {
+    // The map is already registered, so hand back what we have and say so.
+    fail(QObject::tr("entity or script data is corrupt"));
+    message(filename + ": " + error);
+  }
+
+  // The map keeps the file open for as long as its layers use the mapping.
+  if(mapped)
+    map->setMappedFile(f);
+  else
+    delete f;
+
+  return map;
+}
+
+// Leaves errorString() alone so it can run on worker threads.
+bool BinaryMap::peek(QString filename, QString & mapName, QString & tilesetName) {
+  QFile f(filename);
+  if(!f.open(QIODevice::ReadOnly))
+    return false;
+
+  QByteArray header = f.read(HeaderSize);
+  if(header.size() < HeaderSize || memcmp(header.constData(), magic, 4) != 0)
+    return false;
+  if(getU32((const uchar *) header.constData(), 4) != Version)
+    return false;
+
+  // The names are the first things in the meta section.
+  if(!f.seek(getU32((const uchar *) header.constData(), 16)))
+    return false;
+  QDataStream in(&f);
+  in.setVersion(QDataStream::Qt_4_6);
+  in >> mapName >> tilesetName;
+  if(in.status() != QDataStream::Ok)
+    return false;
+
+  return true;
+}
+
+QString BinaryMap::binaryFile(QString xmapFilename) {
+  QFileInfo xmap(xmapFilename);
+  QFileInfo bmap(xmap.path() + "/" + xmap.completeBaseName() + ".bmap");
+
+  if(bmap.exists() && (!xmap.exists() || bmap.lastModified() >= xmap.lastModified()))
+    return bmap.filePath();
+  return QString();
+}
+
+QString BinaryMap::errorString() {
+  return error;
+}
+
+bool BinaryMap::fail(QString e) {
+  error = e;
+  return false;
+}
+
+quint32 BinaryMap::align(quint32 offset) {
+  return (offset + Alignment - 1) / Alignment * Alignment;
+}
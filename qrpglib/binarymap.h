@@ -0,0 +1,50 @@
+#ifndef BINARYMAP_H
+#define BINARYMAP_H 1
+
+#include <QtCore>
+
+class Map;
+
+/* Binary map format (.bmap), a faster alternative to .xmap.  All numbers
+   are little endian.
+
+     header       magic "OEBM", version, layer count, offsets of the
+                  layer table and of the meta section, meta section size
+     layer table  one entry per layer: width, height, offset of its tile
+                  data, offset and length of its UTF-8 name
+     names        layer names
+     tile data    width * height 32-bit tiles per layer, 16-byte aligned
+     meta         QDataStream: map name, tileset, map scripts and, per
+                  layer, the entities with their scripts
+
+   Tile data is used straight from a read-only mapping of the file; layers
+   copy it the first time they are edited. */
+
+class BinaryMap {
+public:
+  enum { Version = 1 };
+
+  static bool write(Map * map, QString filename);
+  // Builds a new Map, or fills in the given unloaded one.
+  static Map * read(QString filename, Map * into = 0);
+  static bool peek(QString filename, QString & mapName, QString & tilesetName);
+  static QString errorString();
+
+  // The .bmap to load instead of the given .xmap, or an empty string if
+  // there is none or the .xmap has been edited since it was written.
+  static QString binaryFile(QString xmapFilename);
+
+private:
+  enum {
+    HeaderSize = 32,
+    LayerEntrySize = 32,
+    Alignment = 16
+  };
+
+  static bool fail(QString e);
+  static quint32 align(quint32 offset);
+
+  static QString error;
+};
+
+#endif
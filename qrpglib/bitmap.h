@@ -6,10 +6,13 @@
 #include <GL/gl.h>
 #include <QtCore>
 #include <QString>
+#include <QImage>
+#include <QFuture>
 #include "globals.h"
 #include "resource.h"
 
 class Resource;
+class TileBatch;
 
 class Bitmap {
 public:
@@ -18,6 +21,8 @@ public:
   ~Bitmap();
   bool setName(QString n);
   void draw(int tile, float x, float y, float opacity = 1.0, float scale = 1.0);
+  void addToBatch(TileBatch & batch, int tile, float x, float y, float scale = 1.0);
+  GLuint getTexture();
   void drawBoundingBox(int tile, float x, float y);
   int tileCount();
   void getSize(int &w, int &h);
@@ -25,13 +30,37 @@ public:
   void getGridSize(int &w, int &h);
   void stub();
   void unStub();
+  // Starts decoding and converting the image on the thread pool; unStub()
+  // then only has to upload it.
+  void requestUpload();
+  bool isPrepared();
+  // False while playing and the texture isn't uploaded yet.
+  bool ensureUploaded();
   QString getName() { return name; }
   void save(QString filename);
+  QImage getImage();
+  void setImage(const QImage & decoded);
+  void setAtlas(GLuint texture, int page_w, int page_h, int x, int y, int w, int h);
+  void clearAtlas();
+  bool isInAtlas() { return atlasTexture != 0; }
+  bool isUploaded() { return !isStub; }
+  qint64 textureBytes();
+  int getLastUsed() { return lastUsed; }
 private:
+  struct Prepared {
+    QImage decoded;
+    QImage converted;
+  };
+
   int pow2(int x);
-  GLuint load_texture(QString name);
+  static Prepared prepareImage(QImage decoded, QString filePath);
+  GLuint load_texture(const Prepared & p);
   GLuint gl_texture;
 
+  // Location of this image inside a shared TextureAtlas page, if any.
+  GLuint atlasTexture;
+  int atlas_x, atlas_y, atlas_w, atlas_h;
+
   QImage * pixmap;
 
   int width, height, x_origin, y_origin;
@@ -39,6 +68,10 @@ private:
   int rows, cols;
 
   bool isStub;
+  bool preparing;
+  QFuture < Prepared > prepared;
+  // TextureResidency frame this bitmap was last drawn in.
+  int lastUsed;
   QString name;
   QString image;
   QString filePath;
@@ -51,17 +84,29 @@ private:
   Resource * thisBitmap;
 };
 
+// parse() reads the tileset and decodes its image and is safe to run on
+// a worker thread; create() builds and registers the Bitmap.
 class BitmapReader : public QXmlStreamReader 
 {
 public:
+  BitmapReader();
+
   Bitmap * read(QIODevice * device);
   Bitmap * read(QString filename);
 
+  bool parse(QIODevice * device);
+  bool parse(QString filename);
+  Bitmap * create();
+
 private:
   void readBitmap();
   void readUnknownElement();
 
-  Bitmap * bitmap;
+  bool hasBitmap;
+  QString bitmapName;
+  QString image;
+  int width, height, x_origin, y_origin;
+  QImage decoded;
   QFileInfo fileinfo;
 };
 
@@ -4,11 +4,15 @@
 
 #include <QImage>
 #include <QtCore>
+#include <QtConcurrentRun>
 #include <qgl.h>
 #include <iostream>
 #include <GL/glu.h>
 #include "globals.h"
 #include "bitmap.h"
+#include "tilebatch.h"
+#include "textureresidency.h"
+#include "trace.h"
 
 using std::cout;
 
@@ -21,6 +25,10 @@ Bitmap::Bitmap(QString image, int spr_w, int spr_h,
   this->width = spr_w;
   this->height = spr_h;
   this->isStub = true;
+  this->preparing = false;
+  this->lastUsed = 0;
+  this->atlasTexture = 0;
+  this->atlas_x = this->atlas_y = this->atlas_w = this->atlas_h = 0;
 
   QFileInfo fileinfo(image);
   this->filePath = fileinfo.absoluteFilePath();
@@ -52,7 +60,26 @@ bool Bitmap::setName(QString n)
 }
 
 void Bitmap::unStub() {
-  this->gl_texture = load_texture(this->filePath);
+  float xo = 0, yo = 0, tw, th;
+
+  if(atlasTexture) {
+    gl_texture = atlasTexture;
+    // The atlas is flipped like any other GL texture, so count rows from its bottom.
+    xo = atlas_x;
+    yo = atlas_h - atlas_y - tex_h;
+    tw = atlas_w;
+    th = atlas_h;
+  } else {
+    // Use the worker's result if requestUpload() started one, else do the
+    // same work here.
+    Prepared p = preparing ? prepared.result() : prepareImage(pixmap ? *pixmap : QImage(), filePath);
+    preparing = false;
+    prepared = QFuture < Prepared >();
+    this->gl_texture = load_texture(p);
+    tw = tex_w;
+    th = tex_h;
+  }
+  lastUsed = TextureResidency::currentFrame();
 
   int x, y;
   Tile * zero = new Tile;
@@ -67,10 +94,10 @@ void Bitmap::unStub() {
       t->y1 = (float) y / (float) pow2(tex_h);
       t->y2 = (float) (y + this->height) / (float) pow2(tex_h);
       */
-      t->x1 = (float) x / (float) tex_w;
-      t->x2 = (float) (x + this->width) / (float) tex_w;
-      t->y1 = (float) y / (float) tex_h;
-      t->y2 = (float) (y + this->height) / (float) tex_h;
+      t->x1 = (xo + x) / tw;
+      t->x2 = (xo + x + this->width) / tw;
+      t->y1 = (yo + y) / th;
+      t->y2 = (yo + y + this->height) / th;
 
       tiles.push_back(t);
     }
@@ -84,17 +111,25 @@ void Bitmap::unStub() {
 
 void Bitmap::stub() {
   int i;
+  if(isStub) return;
   for(i = 0; i < tiles.size(); i++) {
     delete tiles[i];
   }
   tiles.clear();
-  glDeleteTextures(1, &gl_texture);
+  // Atlas pages are owned by TextureAtlas.  GL unbinds a deleted texture,
+  // and its id may be handed out again, so the bind cache has to forget it.
+  if(!atlasTexture) {
+    glDeleteTextures(1, &gl_texture);
+    TileBatch::resetBinding();
+  }
   isStub = true;
   //cout << "Stub\n";
 }
 
 Bitmap::~Bitmap() {
+  TextureResidency::forget(this);
   stub();
+  if(pixmap) delete pixmap;
 }
   
 int Bitmap::tileCount() {
@@ -104,7 +139,8 @@ int Bitmap::tileCount() {
 }
 
 void Bitmap::draw(int tile, float x, float y, float opacity, float scale) {
-  if(isStub) unStub();
+  if(!ensureUploaded()) return;
+  lastUsed = TextureResidency::currentFrame();
   if(tile == 0) return;
 
   int w = width * scale;
@@ -121,7 +157,7 @@ void Bitmap::draw(int tile, float x, float y, float opacity, float scale) {
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   glColor4f(1.0, 1.0, 1.0, opacity);
-  glBindTexture(GL_TEXTURE_2D, gl_texture);
+  TileBatch::bindTexture(gl_texture);
       
   glBegin(GL_QUADS);
   glTexCoord2f(tiles[tile]->x1, tiles[tile]->y1); glVertex3f(x, y + h, 0);
@@ -131,6 +167,25 @@ void Bitmap::draw(int tile, float x, float y, float opacity, float scale) {
   glEnd();
 
   glDisable(GL_TEXTURE_2D);
+  TileBatch::countDrawCall();
+}
+
+void Bitmap::addToBatch(TileBatch & batch, int tile, float x, float y, float scale) {
+  if(isStub) unStub();
+  lastUsed = TextureResidency::currentFrame();
+  if(tile == 0) return;
+
+  // No screen culling here: batches may be cached and drawn at other offsets.
+  int w = width * scale;
+  int h = height * scale;
+
+  batch.addQuad(x, y, w, h, tiles[tile]->x1, tiles[tile]->y1, tiles[tile]->x2, tiles[tile]->y2);
+}
+
+GLuint Bitmap::getTexture() {
+  if(isStub) unStub();
+  lastUsed = TextureResidency::currentFrame();
+  return gl_texture;
 }
 
 void Bitmap::drawBoundingBox(int tile, float x, float y) {
@@ -158,22 +213,53 @@ int Bitmap::pow2(int x) {
   return a;
 }
 
-GLuint Bitmap::load_texture(QString name) {
-  QImage texture;
-  GLuint gltex;
+void Bitmap::requestUpload() {
+  if(!isStub || atlasTexture || preparing) return;
+  prepared = QtConcurrent::run(prepareImage, pixmap ? *pixmap : QImage(), filePath);
+  preparing = true;
+}
 
-  if(pixmap) delete pixmap;
-  pixmap = new QImage;
+bool Bitmap::isPrepared() {
+  return atlasTexture || (preparing && prepared.isFinished());
+}
 
-  if(!pixmap->load(name)) {
-    message("Could not load texture " + name);
-  } 
+bool Bitmap::ensureUploaded() {
+  if(!isStub) return true;
 
-  texture = QGLWidget::convertToGLFormat(*pixmap);
+  // While playing, don't stall the frame on decoding and uploading;
+  // TextureResidency finishes it in a later frame.
+  if(play && !atlasTexture) {
+    TextureResidency::request(this);
+    return false;
+  }
+  unStub();
+  return true;
+}
 
+// Runs on the thread pool: decodes the image unless that has already been
+// done and converts it to what glTexImage2D wants (flipped, RGBA order).
+Bitmap::Prepared Bitmap::prepareImage(QImage decoded, QString filePath) {
+  Prepared p;
+  p.decoded = decoded;
+  if(p.decoded.isNull()) p.decoded.load(filePath);
+  p.converted = QGLWidget::convertToGLFormat(p.decoded);
+  return p;
+}
+
+GLuint Bitmap::load_texture(const Prepared & p) {
+  const QImage & texture = p.converted;
+  GLuint gltex;
+
+  TraceScope trace("texture upload", "texture");
+  if(Trace::isRecording()) trace.setArgs(Trace::args("bitmap", name, "source", filePath));
+
+  if(p.decoded.isNull())
+    message("Could not load texture " + filePath);
+  if(!pixmap)
+    pixmap = new QImage(p.decoded);
 
   glGenTextures(1, &gltex);
-  glBindTexture(GL_TEXTURE_2D, gltex);
+  TileBatch::bindTexture(gltex);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
@@ -211,6 +297,38 @@ void Bitmap::getGridSize(int &w, int &h) {
   h /= height;
 }
 
+// GL memory held by this bitmap's own texture; TextureAtlas counts its pages.
+qint64 Bitmap::textureBytes() {
+  if(isStub || atlasTexture) return 0;
+  return (qint64) tex_w * tex_h * 4;
+}
+
+QImage Bitmap::getImage() {
+  if(!pixmap) pixmap = new QImage(filePath);
+  return *pixmap;
+}
+
+void Bitmap::setImage(const QImage & decoded) {
+  if(pixmap) delete pixmap;
+  pixmap = new QImage(decoded);
+}
+
+void Bitmap::setAtlas(GLuint texture, int page_w, int page_h, int x, int y, int w, int h) {
+  if(!isStub) stub();
+  atlasTexture = texture;
+  atlas_w = page_w;
+  atlas_h = page_h;
+  atlas_x = x;
+  atlas_y = y;
+  tex_w = w;
+  tex_h = h;
+}
+
+void Bitmap::clearAtlas() {
+  if(!isStub) stub();
+  atlasTexture = 0;
+}
+
 void Bitmap::save(QString filename)
 {
   QFile outfile(filename);
@@ -232,10 +350,28 @@ void Bitmap::save(QString filename)
 }
 
 
+BitmapReader::BitmapReader()
+{
+  hasBitmap = false;
+}
+
 Bitmap * BitmapReader::read(QIODevice * device)
+{
+  parse(device);
+  return create();
+}
+
+Bitmap * BitmapReader::read(QString filename)
+{
+  parse(filename);
+  return create();
+}
+
+bool BitmapReader::parse(QIODevice * device)
 {
   setDevice(device);
-  bitmap = 0;
+  hasBitmap = false;
+  decoded = QImage();
   
   while (!atEnd()) {
     readNext();
@@ -248,26 +384,44 @@ Bitmap * BitmapReader::read(QIODevice * device)
     }
   }
 
-  if(!error())
-    return bitmap;
-  else
-    return 0;
+  setDevice(0);
+  if(error()) hasBitmap = false;
+  return hasBitmap;
 }
 
-Bitmap * BitmapReader::read(QString filename)
+bool BitmapReader::parse(QString filename)
 {
   QFile f(filename);
   f.open(QIODevice::ReadOnly);
   fileinfo = QFileInfo(f);
-  return read(&f);
+  if(!parse(&f)) return false;
+
+  // The image path is relative to the tileset file.  A failed decode is
+  // reported later by Bitmap::load_texture.
+  decoded.load(QFileInfo(fileinfo.absoluteDir(), image).absoluteFilePath());
+  return true;
+}
+
+Bitmap * BitmapReader::create()
+{
+  if(!hasBitmap)
+    return 0;
+
+  Bitmap * bitmap = new Bitmap(image, width, height, x_origin, y_origin, bitmapName);
+  if(!decoded.isNull())
+    bitmap->setImage(decoded);
+
+  decoded = QImage();
+  hasBitmap = false;
+  return bitmap;
 }
 
 void BitmapReader::readBitmap()
 {
   Q_ASSERT(isStartElement() && name() == "tileset");
   QString n = "";
-  QString image = "";
-  int width = 0, height = 0, x_origin = 0, y_origin = 0;
+  image = "";
+  width = height = x_origin = y_origin = 0;
 
   while (!atEnd()) {
     readNext();
@@ -307,7 +461,8 @@ void BitmapReader::readBitmap()
     }
   }
   
-  bitmap = new Bitmap(image, width, height, x_origin, y_origin, n);
+  bitmapName = n;
+  hasBitmap = true;
 }
 
 void BitmapReader::readUnknownElement()
@@ -1,6 +1,8 @@
 #include "collisiontester.h"
 #include "entity.h"
 #include "map.h"
+#include "npc.h"
+#include "entitygrid.h"
 #include "globals.h"
 #include <QtCore>
 #include <math.h>
@@ -11,6 +13,11 @@ using std::min;
 
 bool CollisionTester::test(EntityPointer entity, double &dx, double &dy, double &mx, double &my,
                            QList < EntityPointer > & touching) {
+  return test(entity, dx, dy, mx, my, touching, true);
+}
+
+bool CollisionTester::test(EntityPointer entity, double &dx, double &dy, double &mx, double &my,
+                           QList < EntityPointer > & touching, bool broadphase) {
   double x = entity->getX();
   double y = entity->getY();
   bool collision = false;
@@ -73,8 +80,9 @@ bool CollisionTester::test(EntityPointer entity, double &dx, double &dy, double
     }
   }
 
-  for(int i = 0; i < entity->getMap()->getEntityCount(entity->getLayer()); i++) {
-    EntityPointer b = entity->getMap()->getEntity(entity->getLayer(), i);
+  QList < EntityPointer > others = candidates(entity, dx, dy, broadphase);
+  for(int i = 0; i < others.size(); i++) {
+    EntityPointer b = others[i];
     if(entity == b || !(b->isSolid()) ) continue;
     CollisionData c = entityTest(entity, dx, dy, b);
     if(c.collision && c.distance <= distance) {
@@ -108,6 +116,120 @@ bool CollisionTester::test(EntityPointer entity, double &dx, double &dy, double
   return collision;
 }
 
+// Entities that could be hit when moving by (dx, dy), in layer order.  With
+// broadphase off this is every entity on the layer.
+QList < EntityPointer > CollisionTester::candidates(EntityPointer entity, double dx, double dy, bool broadphase) {
+  QList < EntityPointer > result;
+  Map * map = entity->getMap();
+
+  if(!broadphase) {
+    for(int i = 0; i < map->getEntityCount(entity->getLayer()); i++) {
+      result.append(map->getEntity(entity->getLayer(), i));
+    }
+    return result;
+  }
+
+  Map::Layer * layer = map->getLayer(entity->getLayer());
+  if(!layer) return result;
+  return gridCandidates(layer->grid, entity, dx, dy);
+}
+
+QList < EntityPointer > CollisionTester::gridCandidates(const EntityGrid & grid, EntityPointer entity, double dx, double dy) {
+  QList < EntityPointer > result;
+
+  // Swept bounding box, padded a pixel so boxes that only share an edge are kept.
+  double x1, y1, x2, y2;
+  entity->getRealBoundingBox(x1, y1, x2, y2);
+  QList < Entity * > nearby = grid.query(min(x1, x2) + min(dx, 0.0) - 1,
+                                         min(y1, y2) + min(dy, 0.0) - 1,
+                                         max(x1, x2) + max(dx, 0.0) + 1,
+                                         max(y1, y2) + max(dy, 0.0) + 1);
+  for(int i = 0; i < nearby.size(); i++) {
+    result.append(nearby[i]->getSharedPointer());
+  }
+  return result;
+}
+
+// Runs random moves through both the grid and a full scan of the layer and
+// returns how many gave different results.
+int CollisionTester::verifyBroadphase(Map * map, int layer, int trials) {
+  int mismatches = 0;
+  if(!map || map->getEntityCount(layer) == 0) return 0;
+
+  for(int t = 0; t < trials; t++) {
+    EntityPointer e = map->getEntity(layer, qrand() % map->getEntityCount(layer));
+    if(!e->getMap()) continue;
+
+    double dx = (qrand() % 9601 - 4800) / 100.0;
+    double dy = (qrand() % 9601 - 4800) / 100.0;
+
+    double gdx = dx, gdy = dy, gmx, gmy;
+    double bdx = dx, bdy = dy, bmx, bmy;
+    QList < EntityPointer > gtouching, btouching;
+    bool g = test(e, gdx, gdy, gmx, gmy, gtouching, true);
+    bool b = test(e, bdx, bdy, bmx, bmy, btouching, false);
+
+    if(g != b || gdx != bdx || gdy != bdy || gmx != bmx || gmy != bmy || gtouching != btouching) {
+      mismatches++;
+      cprint("Broadphase mismatch: " + e->getName() + " moving " +
+             QString::number(dx) + ", " + QString::number(dy));
+    }
+  }
+
+  return mismatches;
+}
+
+// Same check without a map: scatters count entities of assorted sizes over
+// a scratch grid, including negative coordinates, and compares the hits
+// among the grid's candidates with the hits of a scan over all of them.
+// One entity is moved after every trial so grid updates are covered too.
+int CollisionTester::selfTest(int count, int trials) {
+  int mismatches = 0;
+  EntityGrid grid;
+  QList < EntityPointer > all;
+
+  for(int i = 0; i < count; i++) {
+    QString name = QString("broadphase test %1").arg(i);
+    while(staticEntityNames.contains(name)) name += "'";
+    EntityPointer e = (new Npc(name))->getSharedPointer();
+    e->setBoundingBox(0, 0, 4 + qrand() % 92, 4 + qrand() % 92);
+    e->setPos(qrand() % 2048 - 512, qrand() % 2048 - 512);
+    e->setSpatialOrder(i);
+    grid.insert(e.data());
+    all.append(e);
+  }
+
+  for(int t = 0; t < trials && !all.isEmpty(); t++) {
+    EntityPointer e = all[qrand() % all.size()];
+    double dx = (qrand() % 9601 - 4800) / 100.0;
+    double dy = (qrand() % 9601 - 4800) / 100.0;
+
+    QList < EntityPointer > nearby = gridCandidates(grid, e, dx, dy);
+    QList < EntityPointer > gridHits, scanHits;
+    for(int i = 0; i < nearby.size(); i++) {
+      if(nearby[i] != e && entityTest(e, dx, dy, nearby[i]).collision) gridHits.append(nearby[i]);
+    }
+    for(int i = 0; i < all.size(); i++) {
+      if(all[i] != e && entityTest(e, dx, dy, all[i]).collision) scanHits.append(all[i]);
+    }
+
+    if(gridHits != scanHits) {
+      mismatches++;
+      cprint("Broadphase mismatch: " + e->getName() + " moving " +
+             QString::number(dx) + ", " + QString::number(dy));
+    }
+
+    all[qrand() % all.size()]->setPos(qrand() % 2048 - 512, qrand() % 2048 - 512);
+  }
+
+  grid.clear();
+  for(int i = 0; i < all.size(); i++) {
+    all[i]->destroy();
+    staticEntityNames.remove(all[i]->getName());
+  }
+  return mismatches;
+}
+
 bool CollisionTester::stationaryTest(
   double x1, double y1, double x2, double y2,
   double tx1, double ty1, double tx2, double ty2)
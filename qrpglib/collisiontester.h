@@ -5,6 +5,7 @@
 
 class Map;
 class Entity;
+class EntityGrid;
 
 typedef QSharedPointer<Entity> EntityPointer;
 
@@ -13,6 +14,9 @@ public:
   static bool test(EntityPointer entity, double &dx, double &dy, double & mx, double &my,
                    QList < EntityPointer > & touching);
 
+  static int verifyBroadphase(Map * map, int layer, int trials);
+  static int selfTest(int count, int trials);
+
 
   static bool stationaryTest(
     double x1, double y1, double x2, double y2,
@@ -20,6 +24,11 @@ public:
   );
 
 private:
+  static bool test(EntityPointer entity, double &dx, double &dy, double & mx, double &my,
+                   QList < EntityPointer > & touching, bool broadphase);
+  static QList < EntityPointer > candidates(EntityPointer entity, double dx, double dy, bool broadphase);
+  static QList < EntityPointer > gridCandidates(const EntityGrid & grid, EntityPointer entity, double dx, double dy);
+
   struct CollisionData {
     double distance;
     double move_x, move_y;
@@ -6,9 +6,14 @@
 #include "mapbox.h"
 #include "player.h"
 #include "collisiontester.h"
+#include "profiler.h"
+#include "trace.h"
 #include "npc.h"
 #include "scripttab.h"
 #include "rpgscript.h"
+#include "entitygrid.h"
+#include "triggerindex.h"
+#include "rpgengine.h"
 
 Entity::Entity(QString newname, bool dynamic) : QObject() {
   init();
@@ -43,6 +48,8 @@ Entity::Entity(const Entity & e) : QObject(), QScriptable() {
   sprite = e.sprite;
   x = e.x;
   y = e.y;
+  prev_x = x;
+  prev_y = y;
   layer = e.layer;
   solid = e.solid;
   map = e.map;
@@ -80,7 +87,16 @@ void Entity::destroy() {
 
 }
 
+// Undoes destroy(): registers the entity again and puts it back on its map.
+void Entity::restore() {
+  if(id) entities[id] = sharedPointer;
+  if(dynamic) entityNames[name] = id;
+  if(map) map->addEntity(layer, sharedPointer);
+}
+
 Entity::~Entity() {
+  if(spatialGrid) spatialGrid->remove(this);
+  if(triggerIndex) triggerIndex->remove(this);
   destroy();
 }
 
@@ -89,11 +105,17 @@ QScriptValue & Entity::getScriptObject() {
 }
 
 void Entity::init() {
-  //map = 0;
+  map = 0;
   state = 0;
   frame = 0;
-  //sprite = 0;
+  animationState = 0;
+  animationStart = apptime.elapsed();
+  sprite = 0;
   x = y = 0;
+  prev_x = prev_y = 0;
+  spatialGrid = 0;
+  triggerIndex = 0;
+  spatialOrder = 0;
   bx1 = by1 = bx2 = by2 = 0;
   layer = 0;
   id = 0;
@@ -115,8 +137,19 @@ void Entity::setName(QString newname) {
 }
 
 void Entity::draw(double x_offset, double y_offset, double opacity, bool boundingbox) {
+  double dx = getDrawX();
+  double dy = getDrawY();
+
+  // Each entity runs its own animation clock, restarted whenever its state
+  // changes, so entities sharing a sprite don't animate in lockstep.
+  int now = apptime.elapsed();
+  if(state != animationState) {
+    animationState = state;
+    animationStart = now;
+  }
+
   if(sprite)
-    sprite->draw(state, apptime.elapsed(), (int) (x - x_offset), (int) (y - y_offset), opacity);
+    sprite->draw(state, now - animationStart, (int) (dx - x_offset), (int) (dy - y_offset), opacity);
 
   // If we're drawing bounding boxes, or we're in the editor and there's no visible sprite, draw
   // a bounding box
@@ -126,14 +159,26 @@ void Entity::draw(double x_offset, double y_offset, double opacity, bool boundin
     getBoundingBox(x1, y1, x2, y2);
     glColor4f(0.4, 0.4, 0.8, 0.5);
     glBegin(GL_QUADS);
-    glVertex3f(x + x1 - x_offset, y + y1 - y_offset, 0);
-    glVertex3f(x + x2 - x_offset, y + y1 - y_offset, 0);
-    glVertex3f(x + x2 - x_offset, y + y2 - y_offset, 0);
-    glVertex3f(x + x1 - x_offset, y + y2 - y_offset, 0);
+    glVertex3f(dx + x1 - x_offset, dy + y1 - y_offset, 0);
+    glVertex3f(dx + x2 - x_offset, dy + y1 - y_offset, 0);
+    glVertex3f(dx + x2 - x_offset, dy + y2 - y_offset, 0);
+    glVertex3f(dx + x1 - x_offset, dy + y2 - y_offset, 0);
     glEnd();
   }
 }
 
+// True if anything draw() could put on screen touches the given area.
+bool Entity::isVisibleIn(double x1, double y1, double x2, double y2) {
+  int sx1, sy1, sx2, sy2, bx1, by1, bx2, by2;
+  getSpriteBox(sx1, sy1, sx2, sy2);
+  getBoundingBox(bx1, by1, bx2, by2);
+
+  double dx = getDrawX();
+  double dy = getDrawY();
+  return dx + qMax(sx2, bx2) >= x1 && dx + qMin(sx1, bx1) <= x2 &&
+         dy + qMax(sy2, by2) >= y1 && dy + qMin(sy1, by1) <= y2;
+}
+
 void Entity::update() {
   // Execute scripts.
   for(int i = 0; i < scripts.size(); i++) {
@@ -144,47 +189,19 @@ void Entity::update() {
     } else if(s->condition == ScriptCondition::Enter ||
               s->condition == ScriptCondition::Activate ||
               s->condition == ScriptCondition::Exit) {
-      double x1, y1, x2, y2;
-      double px1, py1, px2, py2;
-      playerEntity->getRealBoundingBox(px1, py1, px2, py2);
-      if(s->useDefaultBounds) {
-        getRealBoundingBox(x1, y1, x2, y2);
-        x1--;
-        y1--;
-        x2++;
-        y2++;
-      } else {
-        getRealScriptBoundingBox(i, x1, y1, x2, y2);
-      }
-
-      if(s->condition == ScriptCondition::Enter) {
-        s->wasTouching = s->isTouching;
-        s->isTouching = CollisionTester::stationaryTest(x1, y1, x2, y2, px1, py1, px2, py2);
-        if(s->isTouching && !s->wasTouching) execute = true;
-      } else if(playerEntity->isActivated() && s->condition == ScriptCondition::Activate) {
-        execute = CollisionTester::stationaryTest(x1, y1, x2, y2, px1, py1, px2, py2);
-      } else if(s->condition == ScriptCondition::Exit) {
-        s->wasTouching = s->isTouching;
-        s->isTouching = CollisionTester::stationaryTest(x1, y1, x2, y2, px1, py1, px2, py2);
-        if(!s->isTouching && s->wasTouching) execute = true;
-      }
+      // The map's TriggerIndex has already tested these against the player.
+      execute = s->triggered;
+      s->triggered = false;
     //} else if(activated && scripts[i].condition == ScriptCondition::Activate) {
     } else if(s->condition == ScriptCondition::EveryFrame) {
       execute = true;
     }
 
-    //push context
     if(execute) {
-      //cprint("execute: " + s->script + "\n");
-      QScriptContext * context = scriptEngine->pushContext();
-      //Npc * n = dynamic_cast< Npc * >(this);
-      context->setThisObject(scriptObject);
-      scriptEngine->evaluate(s->script);
-
-      if(scriptEngine->hasUncaughtException()) 
-        message(scriptEngine->uncaughtException().toString());
-
-      scriptEngine->popContext();
+      ProfileScope scope(Profiler::EntityScripts);
+      if(Trace::isRecording())
+        scope.setArgs(Trace::args("entity", name, "source", map ? map->getSourceFile() : QString()));
+      s->run(scriptObject);
     }
   }
   
@@ -199,19 +216,7 @@ void Entity::runUnLoadScripts() {
       execute = true;
     }
 
-    //push context
-    if(execute) {
-      //cprint("execute: " + s->script + "\n");
-      QScriptContext * context = scriptEngine->pushContext();
-      //Npc * n = dynamic_cast< Npc * >(this);
-      context->setThisObject(scriptObject);
-      scriptEngine->evaluate(s->script);
-
-      if(scriptEngine->hasUncaughtException())
-        message(scriptEngine->uncaughtException().toString());
-
-      scriptEngine->popContext();
-    }
+    if(execute) s->run(scriptObject);
   }
 }
 
@@ -232,11 +237,13 @@ Sprite * Entity::getSprite() {
 }
 
 void Entity::setSprite(Sprite * newSprite) {
+  if(sprite != newSprite) animationStart = apptime.elapsed();
   sprite = newSprite;
+  updateSpatialIndex();
 }
 
 void Entity::setSprite(QString s) {
-  sprite = sprites[spritenames[s]];
+  setSprite(sprites[spritenames[s]]);
 }
 
 double Entity::getX() {
@@ -247,22 +254,42 @@ double Entity::getY() {
   return y;
 }
 
+// Setting a position directly is a jump, so don't interpolate towards it.
 void Entity::setX(double newX) {
-  x = newX;
+  x = prev_x = newX;
+  updateSpatialIndex();
 }
 
 void Entity::setY(double newY) {
-  y = newY;
+  y = prev_y = newY;
+  updateSpatialIndex();
 }
 
 void Entity::setPos(double newX, double newY) {
-  x = newX;
-  y = newY;
+  x = prev_x = newX;
+  y = prev_y = newY;
+  updateSpatialIndex();
+}
+
+void Entity::savePosition() {
+  prev_x = x;
+  prev_y = y;
+}
+
+double Entity::getDrawX() {
+  if(!play) return x;
+  return prev_x + (x - prev_x) * renderAlpha;
+}
+
+double Entity::getDrawY() {
+  if(!play) return y;
+  return prev_y + (y - prev_y) * renderAlpha;
 }
 
 void Entity::movePos(double dx, double dy) {
   x += dx;
   y += dy;
+  updateSpatialIndex();
 }
 
 QString Entity::getName() {
@@ -275,6 +302,8 @@ void Entity::move(double dx, double dy) {
   QList < EntityPointer > touching;
   //cprint("Move: " + QString::number(dx) + ", " + QString::number(dy));
   if(solid) {
+    ProfileScope scope(Profiler::Collision);
+    if(Trace::isRecording()) scope.setArgs(Trace::args("entity", name));
     CollisionTester::test(sharedPointer, dx, dy, mx, my, touching);
   }
 
@@ -285,6 +314,7 @@ void Entity::move(double dx, double dy) {
 
   x += dx;
   y += dy;
+  updateSpatialIndex();
 
   //cprint("Additional move: " + QString::number(mx) + ", " + QString::number(my) + " - " + QString::number(fabs(mx) + fabs(my)));
   if(mx || my) {
@@ -294,7 +324,8 @@ void Entity::move(double dx, double dy) {
 }
 
 void Entity::addToMap(int layer) {
-  map = mapBox->getMap();
+  map = RPGEngine::getCurrentMap();
+  if(!map) return;
   map->addEntity(layer, sharedPointer);
 }
 
@@ -317,6 +348,13 @@ void Entity::getBoundingBox(int & x1, int & y1, int & x2, int & y2) {
   }
 }
 
+void Entity::getStoredBoundingBox(int & x1, int & y1, int & x2, int & y2) {
+  x1 = bx1;
+  y1 = by1;
+  x2 = bx2;
+  y2 = by2;
+}
+
 void Entity::getRealBoundingBox(double & x1, double & y1, double & x2, double & y2) {
   int x1i, y1i, x2i, y2i;
   /*
@@ -394,10 +432,12 @@ bool Entity::isSolid() {
 
 void Entity::addScript(int cond, QString scr, bool useDefaultBounds, int x1, int y1, int x2, int y2) {
   scripts.append(EntityScript(cond, scr, useDefaultBounds, x1, y1, x2, y2));
+  updateSpatialIndex();
 }
 
 void Entity::clearScripts() {
   scripts.clear();
+  updateSpatialIndex();
 }
 
 int Entity::getScriptCount() const {
@@ -423,13 +463,57 @@ void Entity::getScriptBoundingBox(int index, int & x1, int & y1, int & x2, int &
   y2 = scripts[index].y2;
 }
 
+// Moving between layers' entity lists goes through Map::addEntity, which
+// also moves the entity to the new layer's grid.
 void Entity::setLayer(int l) {
   layer = l;
+  updateSpatialIndex();
+}
+
+void Entity::setSpatialGrid(EntityGrid * g) {
+  spatialGrid = g;
+}
+
+EntityGrid * Entity::getSpatialGrid() {
+  return spatialGrid;
+}
+
+void Entity::setSpatialOrder(int i) {
+  spatialOrder = i;
+}
+
+int Entity::getSpatialOrder() {
+  return spatialOrder;
+}
+
+void Entity::setTriggerIndex(TriggerIndex * t) {
+  triggerIndex = t;
+}
+
+TriggerIndex * Entity::getTriggerIndex() {
+  return triggerIndex;
+}
+
+EntityScript * Entity::getEntityScript(int index) {
+  return &(scripts[index]);
+}
+
+// The area the player has to touch to set off an Enter, Exit or Activate script.
+void Entity::getTriggerBoundingBox(int index, double & x1, double & y1, double & x2, double & y2) {
+  if(scripts[index].useDefaultBounds) {
+    getRealBoundingBox(x1, y1, x2, y2);
+    x1--;
+    y1--;
+    x2++;
+    y2++;
+  } else {
+    getRealScriptBoundingBox(index, x1, y1, x2, y2);
+  }
 }
 
-bool Entity::entity_y_order(EntityPointer a, EntityPointer b) {
-  if(a->getY() < b->getY()) return true;
-  return false;
+void Entity::updateSpatialIndex() {
+  if(spatialGrid) spatialGrid->update(this);
+  if(triggerIndex) triggerIndex->update(this);
 }
 
 bool Entity::getOverrideBoundingBox() {
@@ -438,6 +522,7 @@ bool Entity::getOverrideBoundingBox() {
 
 void Entity::setOverrideBoundingBox(bool b) {
   overrideBoundingBox = b;
+  updateSpatialIndex();
 }
 
 bool Entity::isInvisible() {
@@ -453,6 +538,7 @@ void Entity::setBoundingBox(int x1, int y1, int x2, int y2) {
   by1 = y1;
   bx2 = x2;
   by2 = y2;
+  updateSpatialIndex();
 }
 
 EntityPointer Entity::getSharedPointer() {
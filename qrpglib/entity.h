@@ -8,6 +8,8 @@
 #include "resource.h"
 
 class Entity;
+class EntityGrid;
+class TriggerIndex;
 
 typedef QSharedPointer<Entity> EntityPointer;
 typedef QSharedPointer<QObject> ObjectPointer;
@@ -27,16 +29,34 @@ public:
   void init();
   virtual void update();
   void draw(double x_offset, double y_offset, double opacity = 1.0, bool boundingbox = false);
-  static bool entity_y_order(EntityPointer a, EntityPointer b);
+  bool isVisibleIn(double x1, double y1, double x2, double y2);
+  void restore();
+  void savePosition();
+  double getDrawX();
+  double getDrawY();
+  void setSpatialGrid(EntityGrid * g);
+  EntityGrid * getSpatialGrid();
+  void setTriggerIndex(TriggerIndex * t);
+  TriggerIndex * getTriggerIndex();
+  EntityScript * getEntityScript(int index);
+  void getTriggerBoundingBox(int index, double & x1, double & y1, double & x2, double & y2);
+  void setSpatialOrder(int i);
+  int getSpatialOrder();
 
 protected:
   int state;
   int frame;
+  int animationState;
+  int animationStart;
   int layer;
   Sprite * sprite;
   Map * map;
   Resource * thisEntity;
   double x, y;
+  double prev_x, prev_y;
+  EntityGrid * spatialGrid;
+  TriggerIndex * triggerIndex;
+  int spatialOrder;
   int bx1, by1, bx2, by2;
   QString name;
   bool solid;
@@ -49,6 +69,8 @@ protected:
   bool invisible;
   bool dynamic;
 
+  void updateSpatialIndex();
+
 public slots:
   virtual EntityPointer clone() = 0;
   int getState();
@@ -71,6 +93,7 @@ public slots:
   QString getName();
   void addToMap(int);
   void getBoundingBox(int &, int &, int &, int &);
+  void getStoredBoundingBox(int &, int &, int &, int &);
   void getRealBoundingBox(double &, double &, double &, double &);
   void getSpriteBox(int &, int &, int &, int &);
   void getRealSpriteBox(double &, double &, double &, double &);
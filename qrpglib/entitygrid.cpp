@@ -0,0 +1,138 @@
+#include <QtCore>
+#include <math.h>
+#include "entitygrid.h"
+#include "entity.h"
+
+EntityGrid::EntityGrid() {
+}
+
+EntityGrid::~EntityGrid() {
+  clear();
+}
+
+bool EntityGrid::Range::operator==(const Range & r) const {
+  return x1 == r.x1 && y1 == r.y1 && x2 == r.x2 && y2 == r.y2;
+}
+
+void EntityGrid::insert(Entity * e) {
+  if(ranges.contains(e)) {
+    update(e);
+    return;
+  }
+  if(e->getSpatialGrid()) e->getSpatialGrid()->remove(e);
+
+  Range r = entityRange(e);
+  ranges.insert(e, r);
+  addToCells(e, r);
+  e->setSpatialGrid(this);
+}
+
+void EntityGrid::update(Entity * e) {
+  QHash < Entity *, Range >::iterator i = ranges.find(e);
+  if(i == ranges.end()) return;
+
+  // Most moves stay inside the same cells.
+  Range r = entityRange(e);
+  if(r == i.value()) return;
+
+  removeFromCells(e, i.value());
+  addToCells(e, r);
+  i.value() = r;
+}
+
+void EntityGrid::remove(Entity * e) {
+  QHash < Entity *, Range >::iterator i = ranges.find(e);
+  if(i == ranges.end()) return;
+
+  removeFromCells(e, i.value());
+  ranges.erase(i);
+  e->setSpatialGrid(0);
+}
+
+void EntityGrid::clear() {
+  QHash < Entity *, Range >::iterator i;
+  for(i = ranges.begin(); i != ranges.end(); ++i) {
+    i.key()->setSpatialGrid(0);
+  }
+  ranges.clear();
+  cells.clear();
+}
+
+bool EntityGrid::contains(Entity * e) const {
+  return ranges.contains(e);
+}
+
+int EntityGrid::count() const {
+  return ranges.size();
+}
+
+// Returns every entity whose box may touch the given area, in the same order
+// as the layer's entity list so callers see the same results as a full scan.
+QList < Entity * > EntityGrid::query(double x1, double y1, double x2, double y2) const {
+  QList < Entity * > result;
+  QSet < Entity * > seen;
+  Range r = cellRange(x1, y1, x2, y2);
+
+  for(int cy = r.y1; cy <= r.y2; cy++) {
+    for(int cx = r.x1; cx <= r.x2; cx++) {
+      QHash < qint64, QVector < Entity * > >::const_iterator c = cells.find(key(cx, cy));
+      if(c == cells.end()) continue;
+
+      for(int i = 0; i < c.value().size(); i++) {
+        Entity * e = c.value()[i];
+        if(seen.contains(e)) continue;
+        seen.insert(e);
+        result.append(e);
+      }
+    }
+  }
+
+  qSort(result.begin(), result.end(), spatialOrder);
+  return result;
+}
+
+EntityGrid::Range EntityGrid::cellRange(double x1, double y1, double x2, double y2) const {
+  Range r;
+  r.x1 = (int) floor(qMin(x1, x2) / CellSize);
+  r.y1 = (int) floor(qMin(y1, y2) / CellSize);
+  r.x2 = (int) floor(qMax(x1, x2) / CellSize);
+  r.y2 = (int) floor(qMax(y1, y2) / CellSize);
+  return r;
+}
+
+EntityGrid::Range EntityGrid::entityRange(Entity * e) const {
+  double x1, y1, x2, y2, sx1, sy1, sx2, sy2;
+  e->getRealBoundingBox(x1, y1, x2, y2);
+  e->getRealSpriteBox(sx1, sy1, sx2, sy2);
+  return cellRange(qMin(qMin(x1, x2), qMin(sx1, sx2)), qMin(qMin(y1, y2), qMin(sy1, sy2)),
+                   qMax(qMax(x1, x2), qMax(sx1, sx2)), qMax(qMax(y1, y2), qMax(sy1, sy2)));
+}
+
+void EntityGrid::addToCells(Entity * e, const Range & r) {
+  for(int cy = r.y1; cy <= r.y2; cy++) {
+    for(int cx = r.x1; cx <= r.x2; cx++) {
+      cells[key(cx, cy)].append(e);
+    }
+  }
+}
+
+void EntityGrid::removeFromCells(Entity * e, const Range & r) {
+  for(int cy = r.y1; cy <= r.y2; cy++) {
+    for(int cx = r.x1; cx <= r.x2; cx++) {
+      QHash < qint64, QVector < Entity * > >::iterator c = cells.find(key(cx, cy));
+      if(c == cells.end()) continue;
+
+      int i = c.value().indexOf(e);
+      if(i >= 0) c.value().remove(i);
+      if(c.value().isEmpty()) cells.erase(c);
+    }
+  }
+}
+
+qint64 EntityGrid::key(int cx, int cy) {
+  return ((qint64) cx << 32) | (quint32) cy;
+}
+
+bool EntityGrid::spatialOrder(Entity * a, Entity * b) {
+  return a->getSpatialOrder() < b->getSpatialOrder();
+}
@@ -0,0 +1,43 @@
+#ifndef ENTITYGRID_H
+#define ENTITYGRID_H 1
+
+#include <QtCore>
+
+class Entity;
+
+/* Uniform grid of entity boxes for one map layer.  Entities are registered
+   in every cell their bounding box or sprite touches, so both collision
+   tests and drawing only have to look at the entities near an area. */
+
+class EntityGrid {
+public:
+  enum { CellSize = 64 };
+
+  EntityGrid();
+  ~EntityGrid();
+  void insert(Entity * e);
+  void update(Entity * e);
+  void remove(Entity * e);
+  void clear();
+  bool contains(Entity * e) const;
+  int count() const;
+  QList < Entity * > query(double x1, double y1, double x2, double y2) const;
+
+private:
+  struct Range {
+    int x1, y1, x2, y2;
+    bool operator==(const Range & r) const;
+  };
+
+  Range cellRange(double x1, double y1, double x2, double y2) const;
+  Range entityRange(Entity * e) const;
+  void addToCells(Entity * e, const Range & r);
+  void removeFromCells(Entity * e, const Range & r);
+  static qint64 key(int cx, int cy);
+  static bool spatialOrder(Entity * a, Entity * b);
+
+  QHash < Entity *, Range > ranges;
+  QHash < qint64, QVector < Entity * > > cells;
+};
+
+#endif
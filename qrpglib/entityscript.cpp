@@ -12,4 +12,5 @@ EntityScript::EntityScript(int c, QString s,
   y2 = ny2;
   wasTouching = false;
   isTouching = false;
+  triggered = false;
 };
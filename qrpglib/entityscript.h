@@ -9,6 +9,8 @@ struct EntityScript : public RPGScript {
   int x1, y1, x2, y2;
   bool useDefaultBounds;
   bool wasTouching, isTouching;
+  // Set by the map's TriggerIndex when the script should run this frame.
+  bool triggered;
 };
 
 #endif // ENTITYSCRIPT_H
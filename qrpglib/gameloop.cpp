@@ -0,0 +1,143 @@
+#include <QtCore>
+#include <stdio.h>
+#include "gameloop.h"
+#include "globals.h"
+#include "mapbox.h"
+#include "mapscene.h"
+#include "profiler.h"
+#include "rpgengine.h"
+#include "map.h"
+
+GameLoop::GameLoop(QObject * parent) : QObject(parent) {
+  lastTime = lastRender = 0;
+  accumulator = 0;
+  stepTime = 1000.0 / 60;
+  stepRemainder = 0;
+  fpsCap = 60;
+  maxSteps = 5;
+  running = false;
+
+  timer.setSingleShot(true);
+  connect(&timer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+void GameLoop::start() {
+  running = true;
+  accumulator = 0;
+  clock.start();
+  lastTime = lastRender = 0;
+  stepRemainder = 0;
+  timeSinceLastFrame = (int) stepTime;
+  timer.start(0);
+}
+
+void GameLoop::stop() {
+  running = false;
+  timer.stop();
+}
+
+bool GameLoop::isRunning() {
+  return running;
+}
+
+void GameLoop::setStepRate(int stepsPerSecond) {
+  if(stepsPerSecond > 0) stepTime = 1000.0 / stepsPerSecond;
+}
+
+int GameLoop::getStepRate() {
+  return qRound(1000.0 / stepTime);
+}
+
+// 0 removes the cap; frames are then paced by the buffer swap (vsync).
+void GameLoop::setFpsCap(int fps) {
+  fpsCap = qMax(fps, 0);
+}
+
+int GameLoop::getFpsCap() {
+  return fpsCap;
+}
+
+void GameLoop::setMaxSteps(int steps) {
+  maxSteps = qMax(steps, 1);
+}
+
+void GameLoop::tick() {
+  if(!running) return;
+
+  qint64 now = clock.elapsed();
+  accumulator += now - lastTime;
+  lastTime = now;
+
+  int steps = 0;
+  while(accumulator >= stepTime && steps < maxSteps) {
+    step();
+    accumulator -= stepTime;
+    steps++;
+  }
+
+  // After a stall, drop the time we couldn't catch up on instead of
+  // spiralling into ever longer catch-up frames.
+  if(accumulator >= stepTime) accumulator = 0;
+
+  renderAlpha = accumulator / stepTime;
+
+  double renderInterval = fpsCap ? 1000.0 / fpsCap : 0;
+  if(now - lastRender >= renderInterval) {
+    lastRender = now;
+    mapBox->viewport()->update();
+  }
+
+  // Sleep until the next step or frame is due.  Uncapped, the buffer swap
+  // paces us instead.
+  int wait = 0;
+  if(fpsCap) {
+    double nextStep = stepTime - accumulator;
+    double nextRender = renderInterval - (clock.elapsed() - lastRender);
+    wait = (int) qMin(nextStep, nextRender);
+  }
+  timer.start(qMax(wait, 0));
+}
+
+void GameLoop::step() {
+  ProfileScope scope(Profiler::Step);
+  // timeSinceLastFrame is whole milliseconds; carry the fraction over so
+  // a second of steps adds up to exactly 1000 ms (16, 17, 17, ... at 60 Hz).
+  stepRemainder += stepTime;
+  timeSinceLastFrame = (int) stepRemainder;
+  stepRemainder -= timeSinceLastFrame;
+  if(mapBox)
+    mapBox->mapScene->step();
+  else
+    RPGEngine::step();
+}
+
+// Runs the given number of steps back to back against a fake clock, with
+// nothing drawn, then prints how long they took.  Each step counts as a
+// frame for the profiler.  Used by qrpgengine --headless.
+int GameLoop::runHeadless(int steps) {
+  Profiler::setEnabled(true);
+  QElapsedTimer wall;
+  wall.start();
+
+  qint64 slowest = 0;
+  for(int i = 0; i < steps; i++) {
+    qint64 t = wall.nsecsElapsed();
+    step();
+    Profiler::endFrame();
+    slowest = qMax(slowest, wall.nsecsElapsed() - t);
+
+    // Deliver queued signals and anything the thread pool finished.
+    QCoreApplication::processEvents();
+  }
+
+  double seconds = wall.nsecsElapsed() / 1e9;
+  double simulated = steps * stepTime / 1000;
+  Map * map = RPGEngine::getCurrentMap();
+
+  printf("%d step(s), %.1f s simulated in %.3f s (%.0f steps/s, %.1fx), slowest step %.2f ms\n",
+         steps, simulated, seconds, seconds > 0 ? steps / seconds : 0,
+         seconds > 0 ? simulated / seconds : 0, slowest / 1e6);
+  printf("current map: %s\n", map ? map->getName().toLocal8Bit().data() : "(none)");
+  printf("%s", Profiler::report().toLocal8Bit().data());
+  return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef GAMELOOP_H
+#define GAMELOOP_H 1
+
+#include <QtCore>
+
+/* Runs the game simulation at a fixed rate, independent of how often Qt
+   repaints the map.  Rendering is requested separately and throttled to
+   the FPS cap; between steps entities are drawn at an interpolated
+   position (see renderAlpha). */
+
+class GameLoop : public QObject {
+  Q_OBJECT
+
+public:
+  GameLoop(QObject * parent = 0);
+
+public slots:
+  void start();
+  void stop();
+  bool isRunning();
+  void setStepRate(int stepsPerSecond);
+  int getStepRate();
+  void setFpsCap(int fps);
+  int getFpsCap();
+  void setMaxSteps(int steps);
+  int runHeadless(int steps);
+
+private slots:
+  void tick();
+
+private:
+  void step();
+
+  QTimer timer;
+  QElapsedTimer clock;
+  qint64 lastTime;
+  qint64 lastRender;
+  double accumulator;
+  double stepTime;
+  // Fraction of a millisecond not yet handed out through timeSinceLastFrame.
+  double stepRemainder;
+  int fpsCap;
+  int maxSteps;
+  bool running;
+};
+
+#endif
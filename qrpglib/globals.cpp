@@ -28,6 +28,7 @@ Resource * currentresource = 0;
 TalkBox * talkBoxTest;
 
 bool is_editor = false;
+bool headless = false;
 bool rpgEngineStarting = false;
 
 TileSelect * tiles;
@@ -52,6 +53,7 @@ MainWindow * mainWindow = 0;
 Map * currentMap = 0;
 QGLWidget * mainGLWidget = 0;
 MapBox * mapBox = 0;
+GameLoop * gameLoop = 0;
 Player * playerEntity = 0;
 QString projDir;
 QRPGConsole * console = 0;
@@ -68,6 +70,7 @@ QmlUtils * qmlUtils;
 QPixmap * talkBoxBackground;
 int timeLastFrame = 0;
 int timeSinceLastFrame = 0;
+double renderAlpha = 1.0;
 int frames = 0;
 int framesThisSecond = 0;
 
@@ -85,6 +88,7 @@ bool paused = false;
 void message(QString s)
 {
   qDebug() << "MESSAGE: " << s;
+  if(headless) return;
   QMessageBox b;
   b.setText(s);
   b.exec();
@@ -92,6 +96,7 @@ void message(QString s)
 
 void cprint(QString s) {
   if(console) console->append(s);
+  else if(headless) qDebug() << s;
 }
 
 void escapeCData(QString & s) {
@@ -74,6 +74,7 @@ class ImageFrame;
 class TalkBox;
 class RPGScript;
 class QmlUtils;
+class GameLoop;
 
 extern TalkBox * talkBoxTest;
 
@@ -119,15 +120,19 @@ extern int screen_y;
 
 extern int timeLastFrame;
 extern int timeSinceLastFrame;
+extern double renderAlpha;
 extern int frames;
 extern int framesThisSecond;
 extern QString projDir;
 
 extern MapBox * mapBox;
+extern GameLoop * gameLoop;
 extern Player * playerEntity;
 extern QRPGConsole * console;
 
 extern bool is_editor;
+// No window, GL context or audio; see qrpgengine --headless.
+extern bool headless;
 
 extern bool viewTilePos;
 extern bool viewEntityNames;
@@ -10,6 +10,7 @@
 #include "globals.h"
 #include "mapwindow.h"
 #include "mapbox.h"
+#include "mapundo.h"
 #include "layerdialog.h"
 
 LayerTable::LayerTable(QWidget * parent) : QTableWidget(parent) {
@@ -220,7 +221,7 @@ void LayerPanel::layerMoved(int oldRow, int newRow) {
   //QMessageBox::warning(0, "info", "layerMoved: " + QString::number(oldRow) + " -> " + 
     //QString::number(newRow));
   //if(newRow > oldRow) newRow -= 1;
-  currentMap->moveLayer(oldRow, newRow);
+  MapUndo::moveLayer(currentMap, oldRow, newRow);
   updateData();
   layerTable->setCurrentCell(newRow, 0);
   //layerTable->setRangeSelected(
@@ -8,8 +8,18 @@
 #include "npc.h"
 #include "player.h"
 #include "rpgscript.h"
+#include "binarymap.h"
+#include "mapreader.h"
+#include "mapcache.h"
+#include "mappreloader.h"
+#include "tileops.h"
+#include "sparsetiles.h"
+#include "mapundo.h"
+#include "profiler.h"
+#include "trace.h"
 #include <GL/gl.h>
 #include <stdlib.h>
+#include <math.h>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
@@ -29,6 +39,8 @@ Map::Map(Bitmap * t, int x, int y, int w, int h, QString mapname) : QObject() {
   starting = true;
   if(tileset) tileset->getSize(tile_w, tile_h);
   name = mapname;
+  mappedFile = 0;
+  loaded = true;
 
   maps.push_back(this);
   mapnames[name] = maps.size() - 1;
@@ -47,6 +59,8 @@ Map::Map()
   view_x = view_y = view_w = view_h = 0;
   name = "Unnamed Map";
   starting = true;
+  mappedFile = 0;
+  loaded = true;
 
   maps.push_back(this);
   mapnames[name] = maps.size() - 1;
@@ -93,50 +107,73 @@ Map::Tile::~Tile() {
 Map::Layer::~Layer() {
   int i;
   for(i = 0; i < border.size(); i++) delete border[i];
-  if(layerdata) delete layerdata;
+  if(layerdata && !mapped) delete [] layerdata;
+  delete sparse;
+  clearChunks();
+  // Entities may outlive the layer; don't leave them pointing at its grid.
+  grid.clear();
 }
 
 Map::Layer::Layer() {
   layerdata = 0;
+  sparse = 0;
+  recorder = 0;
+  mapped = false;
   tileset = 0;
+  initChunks();
 }
   
 Map::Layer::Layer(int h, int w, int fill) {
+  initChunks();
+  sparse = 0;
+  recorder = 0;
+  mapped = false;
   width = w;
   height = h;
   layerdata = new int[h*w];
   wrap = false;
 
-  for(int i = 0; i < h * w; i++) layerdata[i] = fill;
+  TileOps::fill(layerdata, w, h, 0, 0, w, h, fill);
 }
 
 Map::Layer::Layer(Layer * l, int xo, int yo, int w, int h, int fill) {
+  initChunks();
+  sparse = 0;
+  recorder = 0;
+  mapped = false;
   width = w;
   height = h;
   layerdata = new int[h*w];
   wrap = false;
 
-  for(int x = 0; x < width; x++) {
-    for(int y = 0; y < height; y++) {
-      if(x + xo >= 0 && y + yo >= 0 && x + xo < l->width && y + yo < l->height) {
-        layerdata[x + y * w] = l->layerdata[x + xo + (y + yo) * l->width];
-      } else {
-        layerdata[x + y * w] = fill;
+  TileOps::fill(layerdata, w, h, 0, 0, w, h, fill);
+  if(l->sparse) {
+    for(int y = qMax(yo, 0); y < qMin(yo + h, l->height); y++) {
+      for(int x = qMax(xo, 0); x < qMin(xo + w, l->width); x++) {
+        layerdata[(x - xo) + (y - yo) * w] = l->sparse->get(x, y);
       }
     }
+  } else {
+    TileOps::copy(l->layerdata, l->width, l->height, xo, yo, layerdata, w, h, 0, 0, w, h);
   }
 }
 
 Map::Layer::Layer(Layer * l) {
+  initChunks();
+  recorder = 0;
+  mapped = false;
   width = l->width;
   height = l->height;
-  layerdata = new int[height*width];
   wrap = l->wrap;
 
-  for(int x = 0; x < width; x++) {
-    for(int y = 0; y < height; y++) {
-      layerdata[x + y * width] = l->layerdata[x + y * width];
-    }
+  // A sparse layer's chunks are shared with the copy until either changes.
+  if(l->sparse) {
+    sparse = new SparseTiles(*l->sparse);
+    layerdata = 0;
+  } else {
+    sparse = 0;
+    layerdata = new int[height*width];
+    memcpy(layerdata, l->layerdata, width * height * sizeof(int));
   }
 }
 
@@ -145,32 +182,41 @@ void Map::Layer::clear(int fill) {
 }
 
 void Map::Layer::stamp(Layer * l, int xo, int yo, int x_offset, int y_offset, bool skipZero) {
-  for(int x = x_offset; x < width; x++) {
-    for(int y = y_offset; y < height; y++) {
-      if(x + xo >= 0 && y + yo >= 0 && x + xo < l->width && y + yo < l->height) {
-        int t = layerdata[x + y * width];
-        if(!skipZero || t > 0) l->layerdata[x + xo + (y + yo) * l->width] = t;
+  if(l->recorder) {
+    for(int y = qMax(y_offset, -yo); y < height && y + yo < l->height; y++)
+      l->recorder->capture(l, xo + x_offset, y + yo, width - x_offset);
+  }
+
+  if(sparse || l->sparse) {
+    // Tile by tile, so a sparse destination stays sparse.
+    for(int y = qMax(y_offset, -yo); y < height && y + yo < l->height; y++) {
+      for(int x = qMax(x_offset, -xo); x < width && x + xo < l->width; x++) {
+        int t = tileAt(x, y);
+        if(!skipZero || t > 0) l->setTileAt(x + xo, y + yo, t);
       }
     }
+  } else {
+    l->detach();
+    TileOps::copy(layerdata, width, height, x_offset, y_offset,
+                  l->layerdata, l->width, l->height, xo + x_offset, yo + y_offset,
+                  width - x_offset, height - y_offset, skipZero);
   }
+
+  l->invalidate(xo + x_offset, yo + y_offset, width - x_offset, height - y_offset);
 }
 
 void Map::Layer::resize(int w, int h, int fill) {
-  int * newdata = new int[h*w];
-  for(int i = 0; i < h * w; i++) newdata[i] = fill;
-
-  for(int x = 0; x < width; x++) {
-    for(int y = 0; y < height; y++) {
-      if(x < w && y < h) {
-        newdata[x + y * w] = layerdata[x + y * width];
-      }
-    }
-  }
+  bool wasSparse = sparse != 0;
+  if(sparse) detach();
+  int * newdata = TileOps::resized(layerdata, width, height, w, h, fill);
 
-  delete layerdata;
+  if(!mapped) delete [] layerdata;
   layerdata = newdata;
+  mapped = false;
   width = w;
   height = h;
+  if(wasSparse) pack();
+  invalidateAll();
 
   //message("layer resized");
   //dump();
@@ -179,20 +225,150 @@ void Map::Layer::resize(int w, int h, int fill) {
 void Map::Layer::dump() {
   for(int y = 0; y < height; y++) {
     for(int x = 0; x < width; x++) {
-      cout << setw(4) << layerdata[x + y * width] << " ";
+      cout << setw(4) << tileAt(x, y) << " ";
     }
     cout << "\n";
   }
 }
 
+// Tiles loaded from a binary map point into the read-only file mapping;
+// take a private copy before the first change.  Sparse layers go back to
+// a dense array for operations that work on the whole array; those pack()
+// again afterwards.
+void Map::Layer::detach() {
+  if(sparse) {
+    layerdata = new int[width * height];
+    sparse->expand(layerdata);
+    delete sparse;
+    sparse = 0;
+    return;
+  }
+  if(!mapped) return;
+
+  int * data = new int[width * height];
+  memcpy(data, layerdata, width * height * sizeof(int));
+  layerdata = data;
+  mapped = false;
+}
+
 void Map::Layer::fillArea(int xo, int yo, int w, int h, int fill) {
-  for(int x = xo; x < xo + w; x++) {
-    for(int y = yo; y < yo + h; y++) {
-      if(x < width && y < height) {
-        layerdata[x + y * width] = fill;
+  if(recorder) {
+    for(int y = qMax(yo, 0); y < qMin(yo + h, height); y++) recorder->capture(this, xo, y, w);
+  }
+
+  if(sparse) {
+    for(int y = qMax(yo, 0); y < qMin(yo + h, height); y++) {
+      for(int x = qMax(xo, 0); x < qMin(xo + w, width); x++) {
+        sparse->set(x, y, fill);
+      }
+    }
+    if(fill == 0) sparse->compact();
+  } else {
+    detach();
+    TileOps::fill(layerdata, width, height, xo, yo, w, h, fill);
+  }
+  invalidate(xo, yo, w, h);
+}
+
+int Map::Layer::replaceTile(int from, int to) {
+  if(from == to) return 0;
+  int changed;
+  if(sparse && from != 0) {
+    changed = sparse->replace(from, to);
+  } else {
+    bool wasSparse = sparse != 0;
+    detach();
+    changed = TileOps::replace(layerdata, width * height, from, to);
+    if(wasSparse) pack();
+  }
+  if(changed) invalidateAll();
+  return changed;
+}
+
+// Scanline flood fill.  Each seed fills its whole horizontal run, then
+// pushes one seed per run of matching tiles in the rows above and below,
+// so the stack stays small even for huge open areas.  Only tiles inside
+// clip are touched.  Returns the bounding box of the changed tiles.
+QRect Map::Layer::floodFill(int x, int y, int fill, QRect clip) {
+  QRect bounds(0, 0, width, height);
+  clip = clip.isNull() ? bounds : clip.normalized().intersected(bounds);
+  if(!clip.contains(x, y)) return QRect();
+
+  int target = tileAt(x, y);
+  if(target == fill) return QRect();
+  bool wasSparse = sparse != 0;
+  detach();
+
+  int minX = x, maxX = x, minY = y, maxY = y;
+  QStack < QPoint > seeds;
+  seeds.push(QPoint(x, y));
+
+  while(!seeds.isEmpty()) {
+    QPoint p = seeds.pop();
+    int * row = layerdata + p.y() * width;
+    if(row[p.x()] != target) continue;
+
+    int l = p.x(), r = p.x();
+    while(l > clip.left() && row[l - 1] == target) l--;
+    while(r < clip.right() && row[r + 1] == target) r++;
+    if(recorder) recorder->capture(this, l, p.y(), r - l + 1);
+    for(int i = l; i <= r; i++) row[i] = fill;
+
+    minX = qMin(minX, l);
+    maxX = qMax(maxX, r);
+    minY = qMin(minY, p.y());
+    maxY = qMax(maxY, p.y());
+
+    for(int ny = p.y() - 1; ny <= p.y() + 1; ny += 2) {
+      if(ny < clip.top() || ny > clip.bottom()) continue;
+      int * next = layerdata + ny * width;
+      bool inRun = false;
+      for(int i = l; i <= r; i++) {
+        if(next[i] == target) {
+          if(!inRun) seeds.push(QPoint(i, ny));
+          inRun = true;
+        } else {
+          inRun = false;
+        }
       }
     }
   }
+
+  if(wasSparse) pack();
+  QRect changed(QPoint(minX, minY), QPoint(maxX, maxY));
+  invalidate(changed.x(), changed.y(), changed.width(), changed.height());
+  return changed;
+}
+
+void Map::Layer::setTileAt(int x, int y, int tile) {
+  if(sparse) {
+    sparse->set(x, y, tile);
+  } else {
+    detach();
+    layerdata[x + y * width] = tile;
+  }
+}
+
+// Moves the tiles into SparseTiles when that takes at most half the memory.
+// Mapped layers are left alone since their tiles live in the file mapping.
+bool Map::Layer::pack() {
+  if(sparse || mapped || !layerdata) return false;
+
+  SparseTiles * s = new SparseTiles(layerdata, width, height);
+  if(s->memoryUsage() * 2 > (qint64) width * height * sizeof(int)) {
+    delete s;
+    return false;
+  }
+
+  delete [] layerdata;
+  layerdata = 0;
+  sparse = s;
+  return true;
+}
+
+qint64 Map::Layer::memoryUsage() {
+  if(sparse) return sizeof(Layer) + sparse->memoryUsage();
+  return sizeof(Layer) + (qint64) width * height * sizeof(int);
 }
 
 void Map::Layer::runUnLoadScripts() {
@@ -202,18 +378,228 @@ void Map::Layer::runUnLoadScripts() {
   }
 }
 
+// Record each entity's position in the list so grid queries can return
+// candidates in the same order a full scan would.  Only the relative order
+// matters, so removing an entity leaves a gap and an appended entity just
+// takes the next number; the list is only renumbered after it is sorted.
+void Map::Layer::reindexEntities() {
+  for(int i = 0; i < entities.size(); i++) {
+    entities[i]->setSpatialOrder(i);
+  }
+}
+
+// Insertion sort by Y.  Entities only move a little between frames, so the
+// list is nearly sorted and this runs in close to linear time.  Keys are
+// read once up front and entries are swapped in place, so no comparisons
+// touch the shared pointers.  Returns true if the order changed.
+bool Map::Layer::sortEntities(QList < EntityPointer > & list) {
+  int n = list.size();
+  depthKeys.resize(n);
+  double * keys = depthKeys.data();
+  bool sorted = true;
+  for(int i = 0; i < n; i++) {
+    keys[i] = list[i]->getY();
+    if(i && keys[i] < keys[i - 1]) sorted = false;
+  }
+  if(sorted) return false;
+
+  for(int i = 1; i < n; i++) {
+    double key = keys[i];
+    int j = i;
+    while(j > 0 && keys[j - 1] > key) {
+      keys[j] = keys[j - 1];
+      list.swap(j, j - 1);
+      j--;
+    }
+    keys[j] = key;
+  }
+  return true;
+}
+
+Map::Layer::Chunk::Chunk() {
+  dirty = true;
+}
+
+void Map::Layer::initChunks() {
+  chunks_w = chunks_h = 0;
+  chunkTileset = 0;
+}
+
+void Map::Layer::clearChunks() {
+  for(int i = 0; i < chunks.size(); i++) delete chunks[i];
+  chunks.clear();
+  chunks_w = chunks_h = 0;
+}
+
+void Map::Layer::invalidate(int x, int y, int w, int h) {
+  if(chunks.isEmpty() || w <= 0 || h <= 0) return;
+  if(x + w <= 0 || y + h <= 0 || x >= width || y >= height) return;
+
+  int cx1 = qMax(x, 0) / ChunkSize;
+  int cy1 = qMax(y, 0) / ChunkSize;
+  int cx2 = qMin(x + w - 1, width - 1) / ChunkSize;
+  int cy2 = qMin(y + h - 1, height - 1) / ChunkSize;
+
+  for(int cy = cy1; cy <= cy2 && cy < chunks_h; cy++) {
+    for(int cx = cx1; cx <= cx2 && cx < chunks_w; cx++) {
+      Chunk * c = chunks[cx + cy * chunks_w];
+      if(c) c->dirty = true;
+    }
+  }
+}
+
+void Map::Layer::invalidateAll() {
+  for(int i = 0; i < chunks.size(); i++) {
+    if(chunks[i]) chunks[i]->dirty = true;
+  }
+}
+
+Map::Layer::Chunk * Map::Layer::getChunk(int cx, int cy, Bitmap * t, int tw, int th) {
+  int cw = (width + ChunkSize - 1) / ChunkSize;
+  int ch = (height + ChunkSize - 1) / ChunkSize;
+
+  // Throw the cache away if the layer changed size or is drawn with another tileset.
+  if(cw != chunks_w || ch != chunks_h || t != chunkTileset) {
+    clearChunks();
+    chunks.fill(0, cw * ch);
+    chunks_w = cw;
+    chunks_h = ch;
+    chunkTileset = t;
+  }
+
+  if(cx < 0 || cy < 0 || cx >= chunks_w || cy >= chunks_h) return 0;
+
+  Chunk * c = chunks[cx + cy * chunks_w];
+  if(!c) {
+    c = new Chunk;
+    chunks[cx + cy * chunks_w] = c;
+  }
+
+  if(c->dirty) {
+    int x2 = qMin((cx + 1) * ChunkSize, width);
+    int y2 = qMin((cy + 1) * ChunkSize, height);
+
+    c->batch.clear();
+    for(int y = cy * ChunkSize; y < y2; y++) {
+      for(int x = cx * ChunkSize; x < x2; x++) {
+        t->addToBatch(c->batch, tileAt(x, y), x * tw, y * th);
+      }
+    }
+    c->dirty = false;
+  }
+
+  return c;
+}
+
 Map::~Map() {
   // Map scripts
   int i;
 
+  MapUndo::forget(this);
   for(i = 0; i < tiles.size(); i++) delete tiles[i];
   for(i = 0; i < layers.size(); i++) delete layers[i];
+  if(mappedFile) delete mappedFile;
+  MapCache::forget(this);
+  MapPreloader::forget(this);
+}
+
+void Map::setSourceFile(QString filename) {
+  sourceFile = filename;
+  loaded = sourceFile.isEmpty();
+}
+
+QString Map::getSourceFile() {
+  return sourceFile;
+}
+
+bool Map::isLoaded() {
+  return loaded;
+}
+
+// Fills in a map registered as a stub from its file, or from a reader that
+// already parsed it.  A map that fails to load stays empty rather than being
+// retried every frame.
+void Map::load(MapReader * parsed) {
+  if(loaded) return;
+  loaded = true;
+
+  TraceScope trace("map load", "map");
+  if(Trace::isRecording()) trace.setArgs(Trace::args("map", name, "source", sourceFile));
+
+  bool done = false;
+  QString bmap = BinaryMap::binaryFile(sourceFile);
+  if(!bmap.isEmpty()) {
+    done = BinaryMap::read(bmap, this);
+    if(!done) message(bmap + ": " + BinaryMap::errorString());
+  } else if(parsed) {
+    parsed->create(this);
+    done = true;
+  }
+
+  if(!done) {
+    MapReader reader;
+    reader.parse(sourceFile);
+    reader.create(this);
+  }
+  packLayers();
+}
+
+// Switches mostly empty layers to sparse storage.  Returns how many were packed.
+int Map::packLayers() {
+  int packed = 0;
+  for(int i = 0; i < layers.size(); i++) {
+    if(layers[i]->pack()) packed++;
+  }
+  return packed;
+}
+
+QString Map::layerReport() {
+  QString r;
+  for(int i = 0; i < layers.size(); i++) {
+    Layer * l = layers[i];
+    QString storage = l->sparse ? l->sparse->report() : (l->mapped ? "mapped" : "dense");
+    if(i) r += "\n";
+    r += QString("%1: %2x%3, %4, %5 KB").arg(l->name).arg(l->width).arg(l->height)
+      .arg(storage).arg(l->memoryUsage() / 1024);
+  }
+  return r;
+}
+
+// Drops everything load() brought in; name, tileset and file are kept.
+void Map::unload() {
+  if(!loaded || sourceFile.isEmpty()) return;
+
+  clear();
+  while(!layers.isEmpty())
+    delete layers.takeFirst();
+  scripts.clear();
+  if(mappedFile) delete mappedFile;
+  mappedFile = 0;
+  loaded = false;
+}
+
+// Rough size of the loaded map in bytes, for MapCache.
+qint64 Map::memoryUsage() {
+  qint64 total = sizeof(Map);
+  for(int i = 0; i < layers.size(); i++) {
+    total += layers[i]->memoryUsage();
+    total += (layers[i]->startEntities.size() + layers[i]->entities.size()) * EntityCost;
+  }
+  return total;
 }
     
 void Map::update() {
+  ProfileScope scope(Profiler::MapUpdate);
 
   int i = 0;
 
+  // Remember where everything was so frames drawn between steps can interpolate.
+  for(i = 0; i < layers.size(); i++) {
+    for(int j = 0; j < layers[i]->entities.size(); j++) {
+      layers[i]->entities[j]->savePosition();
+    }
+  }
+
   // Map scripts
   for(i = 0; i < scripts.size(); i++) {
     bool execute = false;
@@ -224,22 +610,19 @@ void Map::update() {
       execute = true;
     }
 
-    //push context
     if(execute) {
-      //cprint("execute: " + s->script + "\n");
-      QScriptContext * context = scriptEngine->pushContext();
-      context->setThisObject(scriptObject);
-      scriptEngine->evaluate(s->script);
-
-      if(scriptEngine->hasUncaughtException())
-        message(scriptEngine->uncaughtException().toString());
-
-      scriptEngine->popContext();
+      TraceScope trace("map script", "script");
+      if(Trace::isRecording()) trace.setArgs(Trace::args("map", name, "source", sourceFile));
+      s->run(scriptObject);
     }
   }
 
   // update entities
   if(!paused) {
+    double px1, py1, px2, py2;
+    playerEntity->getRealBoundingBox(px1, py1, px2, py2);
+    triggers.run(px1, py1, px2, py2, playerEntity->isActivated());
+
     if(playerEntity->isActivated()) qDebug() << "player activated";
     for(int i = 0; i < layers.size(); i++) {
       for(int j = 0; j < layers[i]->entities.size(); j++) {
@@ -281,44 +664,54 @@ void Map::setViewport(int x, int y, int w, int h) {
 
 void Map::draw(Layer *layer, int x, int y, float opacity, bool boundingboxes, bool entities) {
   if(layer && tileset) {
-    int xs, ys, h, w, x_off, y_off;
-    int i, j;
-
-    xs = x / tile_w;
-    ys = y / tile_h;
-    w = view_w / tile_w + 2;
-    h = view_h / tile_h + 2;
-    x_off = x % tile_w;
-    y_off = y % tile_h;
-    if(x_off == tile_w) x_off = 0;
-    if(y_off == tile_h) y_off = 0;
-
-    for(j = ys; j < ys + h; j++) {
-      for(i = xs; i < xs + w; i++) {
-        if(i >= 0 && i < layer->width && j >= 0 && j < layer->height) {
-          int tile_x = (i - xs) * tile_w - x_off + view_x;
-          int tile_y = (j - ys) * tile_h - y_off + view_y;
-
-          tileset->draw(getTile(layer, i, j), tile_x, tile_y, opacity);
+    int i;
+    int chunk_w = Layer::ChunkSize * tile_w;
+    int chunk_h = Layer::ChunkSize * tile_h;
+
+    // Range of chunks touching the viewport.  Chunk geometry is stored in
+    // layer pixel coordinates, so shift it into place with the modelview matrix.
+    int cx1 = (int) floor((double) x / chunk_w);
+    int cy1 = (int) floor((double) y / chunk_h);
+    int cx2 = (int) floor((double) (x + view_w) / chunk_w);
+    int cy2 = (int) floor((double) (y + view_h) / chunk_h);
+
+    // Tiles are skipped until the tileset's upload lands.
+    if(tileset->ensureUploaded()) {
+      GLuint texture = tileset->getTexture();
+
+      glPushMatrix();
+      glTranslatef(view_x - x, view_y - y, 0);
+      for(int cy = qMax(cy1, 0); cy <= cy2; cy++) {
+        for(int cx = qMax(cx1, 0); cx <= cx2; cx++) {
+          Layer::Chunk * c = layer->getChunk(cx, cy, tileset, tile_w, tile_h);
+          if(c) c->batch.draw(texture, opacity);
         }
       }
+      glPopMatrix();
     }
 
     if(entities) {
       // Sort entities in Y direction
       if(play) {
-        if(layer->entities.size())
-          qSort(layer->entities.begin(), layer->entities.end(), Entity::entity_y_order);
-
-        for(i = 0; i < layer->entities.size(); i++) {
-          layer->entities[i]->draw(x, y, 1, boundingboxes);
+        if(layer->sortEntities(layer->entities))
+          layer->reindexEntities();
+
+        // Only entities the grid places near the viewport are looked at.  The
+        // query is padded by a cell because drawing interpolates from the
+        // previous position, which the grid doesn't track.
+        QList < Entity * > nearby = layer->grid.query(x - EntityGrid::CellSize, y - EntityGrid::CellSize,
+                                                      x + view_w + EntityGrid::CellSize,
+                                                      y + view_h + EntityGrid::CellSize);
+        for(i = 0; i < nearby.size(); i++) {
+          if(nearby[i]->isVisibleIn(x, y, x + view_w, y + view_h))
+            nearby[i]->draw(x, y, 1, boundingboxes);
         }
       } else {
-        if(layer->startEntities.size())
-          qSort(layer->startEntities.begin(), layer->startEntities.end(), Entity::entity_y_order);
+        layer->sortEntities(layer->startEntities);
 
         for(i = 0; i < layer->startEntities.size(); i++) {
-          layer->startEntities[i]->draw(x, y, opacity, boundingboxes);
+          if(layer->startEntities[i]->isVisibleIn(x, y, x + view_w, y + view_h))
+            layer->startEntities[i]->draw(x, y, opacity, boundingboxes);
         }
       }
     }
@@ -331,11 +724,17 @@ void Map::draw(int layer, int x, int y, float opacity, bool boundingboxes, bool
 }
 
 void Map::addEntity(int layer, EntityPointer entity) {
-  removeEntity(entity->getLayer(), entity);
+  // Keep the entity in the trigger index so its scripts' touching state
+  // survives moving between layers.
+  detachEntity(entity->getLayer(), entity);
   if(layer < layers.size()) {
-    if(play)
-      layers[layer]->entities.push_back(entity);
-    else
+    if(play) {
+      QList < EntityPointer > & list = layers[layer]->entities;
+      entity->setSpatialOrder(list.isEmpty() ? 0 : list.last()->getSpatialOrder() + 1);
+      list.push_back(entity);
+      layers[layer]->grid.insert(entity.data());
+      triggers.insert(entity.data());
+    } else
       layers[layer]->startEntities.push_back(entity);      
 
     entity->setLayer(layer);
@@ -347,10 +746,16 @@ void Map::addStartEntity(int layer, EntityPointer entity) {
 }
 
 void Map::removeEntity(int layer, EntityPointer entity) {
+  detachEntity(layer, entity);
+  if(play) triggers.remove(entity.data());
+}
+
+void Map::detachEntity(int layer, EntityPointer entity) {
   if(layer < layers.size()) {
-    if(play)
+    if(play) {
       layers[layer]->entities.removeAll(entity);
-    else
+      layers[layer]->grid.remove(entity.data());
+    } else
       layers[layer]->startEntities.removeAll(entity);      
   }
 }
@@ -388,7 +793,7 @@ int Map::getTile(int layer, int x, int y) {
   if(layer < layers.size() &&
      x >= 0 && x < layers[layer]->width &&
      y >= 0 && y < layers[layer]->height) 
-    return layers[layer]->layerdata[x + y * layers[layer]->width];
+    return layers[layer]->tileAt(x, y);
   return 0;
 }
 
@@ -396,7 +801,7 @@ int Map::getTile(Layer * layer, int x, int y) {
   if(layer &&
      x >= 0 && x < layer->width &&
      y >= 0 && y < layer->height)
-    return layer->layerdata[x + y * layer->width];
+    return layer->tileAt(x, y);
   return 0;
 }
 
@@ -404,8 +809,59 @@ void Map::setTile(int layer,
 		  int x, int y, int tile) {
   if(layer < layers.size() &&
      x >= 0 && x < layers[layer]->width &&
-     y >= 0 && y < layers[layer]->height) 
-    layers[layer]->layerdata[x + y * layers[layer]->width] = tile;
+     y >= 0 && y < layers[layer]->height) {
+    if(layers[layer]->recorder && layers[layer]->tileAt(x, y) != tile)
+      layers[layer]->recorder->capture(layers[layer], x, y, 1);
+    layers[layer]->setTileAt(x, y, tile);
+    layers[layer]->invalidate(x, y, 1, 1);
+  }
+}
+
+// Bulk versions of setTile for scripts that generate maps; see TileOps.
+void Map::fillTiles(int layer, int x, int y, int w, int h, int tile) {
+  Layer * l = getLayer(layer);
+  if(l) l->fillArea(x, y, w, h, tile);
+}
+
+int Map::replaceTile(int layer, int from, int to) {
+  Layer * l = getLayer(layer);
+  if(!l) return 0;
+  return l->replaceTile(from, to);
+}
+
+void Map::copyTiles(int srcLayer, int x, int y, int w, int h, int dstLayer, int dx, int dy, bool skipZero) {
+  Layer * src = getLayer(srcLayer);
+  Layer * dst = getLayer(dstLayer);
+  if(!src || !dst || w <= 0 || h <= 0) return;
+
+  // Going through a copy keeps overlapping moves within a layer correct.
+  Layer block(src, x, y, w, h);
+  block.stamp(dst, dx, dy, 0, 0, skipZero);
+}
+
+void Map::floodFill(int layer, int x, int y, int tile) {
+  Layer * l = getLayer(layer);
+  if(l) l->floodFill(x, y, tile);
+}
+
+// Tiles of a w x h block, row by row.  Tiles outside the layer read as 0.
+QVariantList Map::getTiles(int layer, int x, int y, int w, int h) {
+  QVariantList result;
+  Layer * l = getLayer(layer);
+  if(!l || w <= 0 || h <= 0) return result;
+
+  Layer block(l, x, y, w, h);
+  for(int i = 0; i < w * h; i++) result.append(block.layerdata[i]);
+  return result;
+}
+
+void Map::setTiles(int layer, int x, int y, int w, int h, QVariantList tiles) {
+  Layer * l = getLayer(layer);
+  if(!l || w <= 0 || h <= 0 || tiles.size() < w * h) return;
+
+  Layer block(h, w);
+  for(int i = 0; i < w * h; i++) block.layerdata[i] = tiles[i].toInt();
+  block.stamp(l, x, y, 0, 0, false);
 }
 
 int Map::getLayerCount() {
@@ -423,21 +879,65 @@ void Map::setTileset(int layer, Bitmap * t) {
 }
 
 int Map::addLayer(int w, int h, bool wrap, int filltile, QString name) {
-  int i;
-
   Layer * l = new Layer;
   l->height = h;
   l->width = w;
   l->wrap = wrap;
   l->name = name;
   l->layerdata = new int[h*w]; //(int *) malloc(h * w * sizeof(int));
-  for(i = 0; i < h * w; i++) {
-    l->layerdata[i] = filltile;
-  }
+  TileOps::fill(l->layerdata, w, h, 0, 0, w, h, filltile);
   
   layers.push_back(l);
   return (int) layers.size() - 1;
 }
+
+// Adds a layer that takes over data, which must come from new int[w * h].
+int Map::addLayer(int w, int h, int * data, QString name) {
+  Layer * l = new Layer;
+  l->height = h;
+  l->width = w;
+  l->wrap = false;
+  l->name = name;
+  l->layerdata = data;
+
+  layers.push_back(l);
+  return (int) layers.size() - 1;
+}
+
+// Adds a layer whose tiles stay in a mapped binary map file (see BinaryMap).
+int Map::addMappedLayer(int w, int h, int * data, QString name) {
+  Layer * l = new Layer;
+  l->height = h;
+  l->width = w;
+  l->wrap = false;
+  l->name = name;
+  l->layerdata = data;
+  l->mapped = true;
+
+  layers.push_back(l);
+  return (int) layers.size() - 1;
+}
+
+void Map::setMappedFile(QFile * f) {
+  if(mappedFile) delete mappedFile;
+  mappedFile = f;
+}
+
+// Copies the layers out of the mapping if it is of the given file, so the
+// file can be overwritten.
+void Map::releaseMappedFile(QString filename) {
+  if(!mappedFile || QFileInfo(*mappedFile) != QFileInfo(filename)) return;
+
+  for(int i = 0; i < layers.size(); i++)
+    layers[i]->detach();
+  delete mappedFile;
+  mappedFile = 0;
+}
+
+void Map::saveBinary(QString filename) {
+  if(!BinaryMap::write(this, filename))
+    message(filename + ": " + BinaryMap::errorString());
+}
   
 void Map::moveLayer(int oldIndex, int newIndex) {
   layers.move(oldIndex, newIndex);
@@ -454,11 +954,25 @@ void Map::insertLayerAfter(int layer, int w, int h, bool wrap, int filltile, QSt
 }
 
 void Map::deleteLayer(int layer) {
-  Layer * l = layers.takeAt(layer);
-  delete l;
+  delete takeLayer(layer);
+}
+
+int Map::indexOfLayer(Layer * l) {
+  return layers.indexOf(l);
+}
+
+// Puts a layer taken out with takeLayer() back; the map owns it again.
+void Map::insertLayer(int index, Layer * l) {
+  layers.insert(qBound(0, index, layers.size()), l);
+}
+
+Map::Layer * Map::takeLayer(int index) {
+  if(index < 0 || index >= layers.size()) return 0;
+  return layers.takeAt(index);
 }
 
 void Map::save(QString filename) {
+  load();
   ofstream file(filename.toAscii());
   int i, x, y;
   int s = layers.size();
@@ -486,7 +1000,7 @@ void Map::save(QString filename) {
     for(y = 0; y < layers[i]->height; y++) {
       file << "      ";
       for(x = 0; x < layers[i]->width; x++) {
-        file << setw(4) << layers[i]->layerdata[y*layers[i]->width+x] << " ";
+        file << setw(4) << layers[i]->tileAt(x, y) << " ";
       }
       file << "\n";
     }
@@ -525,9 +1039,11 @@ void Map::clear() {
   for(int i = 0; i < layers.size(); i++) {
     while(!(layers[i]->entities.isEmpty()))
       layers[i]->entities.takeFirst();
+    layers[i]->grid.clear();
 
     mapentitynames.clear();
   }
+  triggers.clear();
 }
 
 void Map::setStarting(bool s) {
@@ -555,7 +1071,7 @@ int Map::getScriptCondition(int index) const {
 }
 
 Map::Layer * Map::getLayer(int l) {
-  if(l < layers.size())
+  if(l >= 0 && l < layers.size())
     return layers[l];
   else
     return 0;
@@ -579,18 +1095,7 @@ void Map::runUnLoadScripts() {
       execute = true;
     }
 
-    //push context
-    if(execute) {
-      //cprint("execute: " + s->script + "\n");
-      QScriptContext * context = scriptEngine->pushContext();
-      context->setThisObject(scriptObject);
-      scriptEngine->evaluate(s->script);
-
-      if(scriptEngine->hasUncaughtException())
-        message(scriptEngine->uncaughtException().toString());
-
-      scriptEngine->popContext();
-    }
+    if(execute) s->run(scriptObject);
   }
 }
 
@@ -5,10 +5,16 @@
 #include "bitmap.h"
 #include "rpgscript.h"
 #include "entity.h"
+#include "tilebatch.h"
+#include "entitygrid.h"
+#include "triggerindex.h"
+#include "sparsetiles.h"
 #include <QtCore>
 
 class Resource;
 class Bitmap;
+class MapReader;
+class TileDiff;
 typedef QSharedPointer<Entity> EntityPointer;
 
 class Map : public QObject, public QScriptable {
@@ -24,6 +30,16 @@ public:
   };
 
   struct Layer {
+    // Tiles are grouped into ChunkSize x ChunkSize blocks whose quads are
+    // built once and reused until one of their tiles changes.
+    enum { ChunkSize = 32 };
+
+    struct Chunk {
+      Chunk();
+      TileBatch batch;
+      bool dirty;
+    };
+
     Layer();
     Layer(int w, int h, int fill = 0);
     Layer(Layer * l, int xo, int yo, int w, int h, int fill = 0);
@@ -31,20 +47,45 @@ public:
     ~Layer();
     void clear(int fill = 0);
     void fillArea(int x, int y, int w, int h, int fill);
+    QRect floodFill(int x, int y, int fill, QRect clip = QRect());
+    int replaceTile(int from, int to);
+    int tileAt(int x, int y) const { return layerdata ? layerdata[x + y * width] : sparse->get(x, y); }
+    void setTileAt(int x, int y, int tile);
+    bool pack();
+    qint64 memoryUsage();
     void stamp(Layer * l, int x, int y, int x_offset = 0, int y_offset = 0, bool skipZero = true);
     void dump();
     void resize(int w, int h, int fill = 0);
     void runUnLoadScripts();
+    void invalidate(int x, int y, int w, int h);
+    void invalidateAll();
+    void reindexEntities();
+    bool sortEntities(QList < EntityPointer > & list);
+    void detach();
+    Chunk * getChunk(int cx, int cy, Bitmap * t, int tw, int th);
 
     int height, width;
     QString name;
     int * layerdata;
+    SparseTiles * sparse;
+    TileDiff * recorder;
+    bool mapped;
     bool wrap;
     QList < Poly * > border;
     QList < EntityPointer > entities;
     QList < EntityPointer > startEntities;
+    EntityGrid grid;
     Bitmap * tileset;
     int tile_w, tile_h;
+
+    QVector < Chunk * > chunks;
+    int chunks_w, chunks_h;
+    Bitmap * chunkTileset;
+
+  private:
+    QVector < double > depthKeys;
+    void initChunks();
+    void clearChunks();
   };
 
   Map();
@@ -58,6 +99,18 @@ public:
   void setTileset(int layer, Bitmap * t);
   Bitmap * getTileset();
   void save(QString filename);
+  void saveBinary(QString filename);
+  int addMappedLayer(int w, int h, int * data, QString name);
+  int addLayer(int w, int h, int * data, QString name);
+  void setMappedFile(QFile * f);
+  void releaseMappedFile(QString filename);
+  void setSourceFile(QString filename);
+  QString getSourceFile();
+  bool isLoaded();
+  void load(MapReader * parsed = 0);
+  void unload();
+  qint64 memoryUsage();
+  int packLayers();
   Resource * getThisMap() { return thisMap; }
   void update();
   QScriptValue scriptObject;
@@ -69,6 +122,13 @@ public slots:
   void setTile(int layer, int x, int y, int tile);
   int getTile(int layer, int x, int y);
   int getTile(Layer * layer, int x, int y);
+  void fillTiles(int layer, int x, int y, int w, int h, int tile);
+  int replaceTile(int layer, int from, int to);
+  void copyTiles(int srcLayer, int x, int y, int w, int h, int dstLayer, int dx, int dy, bool skipZero = false);
+  void floodFill(int layer, int x, int y, int tile);
+  QVariantList getTiles(int layer, int x, int y, int w, int h);
+  void setTiles(int layer, int x, int y, int w, int h, QVariantList tiles);
+  QString layerReport();
   int getLayerCount();
   QString getLayerName(int layer);
   void setLayerName(int layer, QString name);
@@ -90,6 +150,9 @@ public slots:
   EntityPointer getEntity(int layer, int index);
   EntityPointer getStartEntity(int layer, int index);
   Layer * getLayer(int l);
+  int indexOfLayer(Layer * l);
+  void insertLayer(int index, Layer * l);
+  Layer * takeLayer(int index);
 
   void addScript(int, QString);
   void clearScripts();
@@ -114,8 +177,17 @@ private:
 
   Resource * thisMap;
   QList < RPGScript > scripts;
+  TriggerIndex triggers;
+  QFile * mappedFile;
+  QString sourceFile;
+  bool loaded;
+
+  // Estimated bytes per entity (object, script engine wrapper, scripts).
+  enum { EntityCost = 2048 };
 
   bool starting;
+
+  void detachEntity(int layer, EntityPointer entity);
 };
 
 
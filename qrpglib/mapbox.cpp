@@ -24,6 +24,9 @@
 #include "rpgengine.h"
 #include "rpgscript.h"
 #include "mapscene.h"
+#include "mapcache.h"
+#include "textureresidency.h"
+#include "mapundo.h"
 
 using std::cout;
 
@@ -55,10 +58,26 @@ MapBox::MapBox(QWidget * parent) :
   this->setMouseTracking(true);
 
   setDragMode(QGraphicsView::RubberBandDrag);
+
+  repaintTimer.setSingleShot(true);
+  connect(&repaintTimer, SIGNAL(timeout()), this, SLOT(repaintNow()));
+  lastRepaint.start();
+}
+
+// Coalesces editor repaints: any number of requests inside one interval
+// produce a single redraw.  While playing, GameLoop paces the frames.
+void MapBox::requestRepaint() {
+  if(play || repaintTimer.isActive()) return;
+  repaintTimer.start(qMax(0, RepaintInterval - (int) lastRepaint.elapsed()));
+}
+
+void MapBox::repaintNow() {
+  if(!play) viewport()->update();
 }
 
 void MapBox::setCurrentTile(int t) {
   currentTile = t;
+  requestRepaint();
 }
 
 void MapBox::setCamera(EntityPointer c) {
@@ -102,29 +121,34 @@ void MapBox::resizeEvent(QResizeEvent *event) {
 
   emit resized(w, h);
   QGraphicsView::resizeEvent(event);
+  requestRepaint();
 }
 
 
 void MapBox::setX(int x) {
   //makeCurrent();
   xo = x;
-
-  if(xo < 0) xo = 0;
-  if(xo >= xrange) xo = xrange;
-  if(xo < 0) xo /= 2;
+  clampOrigin();
   //updateGL();
-  update();
+  requestRepaint();
 }
 
 void MapBox::setY(int y) {
   //makeCurrent();
   yo = y;
+  clampOrigin();
+  //updateGL();
+  requestRepaint();
+}
+
+void MapBox::clampOrigin() {
+  if(xo < 0) xo = 0;
+  if(xo >= xrange) xo = xrange;
+  if(xo < 0) xo /= 2;
 
   if(yo < 0) yo = 0;
   if(yo >= yrange) yo = yrange;
   if(yo < 0) yo /= 2;
-  //updateGL();
-  update();
 }
 
 int MapBox::getX() {
@@ -151,7 +175,7 @@ void MapBox::setTile(QMouseEvent * e) {
     map->setTile(layer, x, y, currentTile);
     //makeCurrent();
     //updateGL();
-    update();
+    requestRepaint();
   }
 }  
 
@@ -166,12 +190,12 @@ void MapBox::setTile(QGraphicsSceneMouseEvent * e) {
     map->setTile(layer, x, y, currentTile);
     //makeCurrent();
     //updateGL();
-    update();
+    requestRepaint();
   }
 }  
 
 void MapBox::setLayer(int l) {
-  if(layer >= 0 && layer < map->getLayerCount()) {
+  if(l >= 0 && l < map->getLayerCount()) {
     int lw, lh, tw, th;
     layer = l;
 
@@ -185,7 +209,7 @@ void MapBox::setLayer(int l) {
     yrange = th * lh - height();
     //makeCurrent();
     //updateGL();
-    update();
+    requestRepaint();
   }
 }
 	 
@@ -207,12 +231,13 @@ void MapBox::addLayer(int w, int h, bool wrap, QString name) {
       xrange = tw * lw - width();
       yrange = th * lh - height();
     }
+    requestRepaint();
   }  
 }
 
 void MapBox::deleteLayer(int layer) {
-  map->deleteLayer(layer);
-  if(map->getLayerCount() < layer) layer = map->getLayerCount();
+  MapUndo::deleteLayer(map, layer);
+  if(layer >= map->getLayerCount()) layer = map->getLayerCount() - 1;
   setLayer(layer);
 }
 
@@ -234,10 +259,16 @@ void MapBox::setMap(int map_num) {
   if(map)
     map->runUnLoadScripts();
 
+  // Undo history belongs to the map being left.
+  if(is_editor && (map_num < 0 || maps[map_num] != map))
+    MapUndo::clear();
+
   map = 0;
   RPGEngine::setCurrentMap(0);
   if(map_num >= 0) {
     map = maps[map_num];
+    MapCache::use(map);
+    TextureResidency::prefetch(map);
   }
   layer = 0;
   w = width();
@@ -272,7 +303,8 @@ void MapBox::setMap(int map_num) {
   } else {
     scriptEngine->globalObject().setProperty("map", QScriptValue(QScriptValue::NullValue));
   }
-  
+
+  requestRepaint();
 }
 
 
@@ -286,6 +318,7 @@ void MapBox::saveMap(char * filename) {
 
 void MapBox::setDrawMode(LayerView::LayerViewMode mode) {
   drawMode = mode;
+  requestRepaint();
 }
 
 void MapBox::setEditMode() {
@@ -307,6 +340,7 @@ void MapBox::setBrushMode() {
 void MapBox::setMode(int mode) {
   mapEditorMode = mode;
   emit modeChanged(mode);
+  requestRepaint();
 }
 
 int MapBox::getMode() {
@@ -65,6 +65,7 @@ public slots:
   void setBrushMode();
   void setMode(int mode);
   int getMode();
+  void requestRepaint();
 
 signals:
   void setXRange(int, int);
@@ -76,10 +77,14 @@ signals:
   void mousePos(int, int, int, int);  
   void resized(int, int);
 
+private slots:
+  void repaintNow();
+
 private:
   void setTile(QMouseEvent * e);
   void setTile(QGraphicsSceneMouseEvent * e);
   void resizeEvent(QResizeEvent *event);
+  void clampOrigin();
 
   /*
   bool viewportEvent(QEvent *event);
@@ -102,6 +107,11 @@ private:
   int resizeDirection;
   int mapEditorMode;
   int dragMode;
+
+  // Edit mode only redraws on request, at most once per RepaintInterval ms.
+  enum { RepaintInterval = 16 };
+  QTimer repaintTimer;
+  QElapsedTimer lastRepaint;
 };
 
 #endif
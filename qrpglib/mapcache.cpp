@@ -0,0 +1,68 @@
+#include "mapcache.h"
+#include "map.h"
+#include "globals.h"
+
+QList < Map * > MapCache::recent;
+int MapCache::budget = 128;
+
+void MapCache::use(Map * map) {
+  if(!map) return;
+
+  recent.removeAll(map);
+  recent.prepend(map);
+  map->load();
+  evict();
+}
+
+// For maps loaded ahead of being shown: they go right behind the current
+// map and nothing is evicted until the next use().
+void MapCache::add(Map * map) {
+  if(recent.contains(map)) return;
+  recent.insert(qMin(1, recent.size()), map);
+}
+
+void MapCache::forget(Map * map) {
+  recent.removeAll(map);
+}
+
+void MapCache::clear() {
+  recent.clear();
+}
+
+void MapCache::setBudget(int megabytes) {
+  budget = megabytes;
+  evict();
+}
+
+int MapCache::getBudget() {
+  return budget;
+}
+
+qint64 MapCache::memoryUsage() {
+  qint64 total = 0;
+  for(int i = 0; i < recent.size(); i++) {
+    if(recent[i]->isLoaded()) total += recent[i]->memoryUsage();
+  }
+  return total;
+}
+
+QString MapCache::report() {
+  QString r = QString("%1 map(s) resident, %2 KB of %3 MB budget")
+    .arg(recent.size()).arg(memoryUsage() / 1024).arg(budget);
+  for(int i = 0; i < recent.size(); i++) {
+    r += QString("\n  %1: %2 KB").arg(recent[i]->getName()).arg(recent[i]->memoryUsage() / 1024);
+  }
+  return r;
+}
+
+void MapCache::evict() {
+  // Edits are not tracked, so the editor keeps every map it has opened.
+  if(is_editor) return;
+
+  // The map in front is the one being shown and always stays.  Maps that
+  // were shown ran their unload scripts when MapBox::setMap left them.
+  while(recent.size() > 1 && memoryUsage() > (qint64) budget * 1024 * 1024) {
+    Map * map = recent.takeLast();
+    map->unload();
+  }
+}
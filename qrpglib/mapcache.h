@@ -0,0 +1,33 @@
+#ifndef MAPCACHE_H
+#define MAPCACHE_H 1
+
+#include <QtCore>
+
+class Map;
+
+/* Projects register their maps as stubs that only know their name, tileset
+   and file.  MapCache loads a map when it is shown and keeps the most
+   recently shown ones resident, unloading the least recently used maps once
+   their estimated size goes over the budget. */
+
+class MapCache {
+public:
+  static void use(Map * map);
+  static void add(Map * map);
+  static void forget(Map * map);
+  static void clear();
+
+  static void setBudget(int megabytes);
+  static int getBudget();
+  static qint64 memoryUsage();
+  static QString report();
+
+private:
+  static void evict();
+
+  // Most recently used first.
+  static QList < Map * > recent;
+  static int budget;
+};
+
+#endif
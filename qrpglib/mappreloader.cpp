@@ -0,0 +1,127 @@
+#include <QtCore>
+#include <QtConcurrentRun>
+#include "mappreloader.h"
+#include "mapreader.h"
+#include "binarymap.h"
+#include "mapcache.h"
+#include "map.h"
+#include "bitmap.h"
+#include "player.h"
+#include "globals.h"
+#include "textureresidency.h"
+#include "rpgengine.h"
+
+QList < MapPreloader::Job > MapPreloader::jobs;
+Map * MapPreloader::teleportMap = 0;
+int MapPreloader::teleport_x = 0;
+int MapPreloader::teleport_y = 0;
+
+void MapPreloader::preload(Map * map) {
+  if(!map || findJob(map) >= 0) return;
+
+  Job job;
+  job.map = map;
+  job.built = map->isLoaded();
+  if(job.built)
+    startUploads(job);
+  else
+    job.parse = QtConcurrent::run(parse, map->getSourceFile());
+  jobs.append(job);
+}
+
+bool MapPreloader::isReady(Map * map) {
+  return map->isLoaded() && findJob(map) < 0;
+}
+
+void MapPreloader::teleport(Map * map, int x, int y) {
+  // Staying on the current map only moves the player; switching would run
+  // its unload scripts and reset its entities.
+  if(map == RPGEngine::getCurrentMap()) {
+    teleportMap = 0;
+    if(playerEntity) playerEntity->setPos(x, y);
+    return;
+  }
+
+  preload(map);
+  teleportMap = map;
+  teleport_x = x;
+  teleport_y = y;
+}
+
+void MapPreloader::forget(Map * map) {
+  int i = findJob(map);
+  if(i >= 0) jobs.removeAt(i);
+  if(teleportMap == map) teleportMap = 0;
+}
+
+void MapPreloader::step() {
+  // Build at most one parsed map per step.
+  for(int i = 0; i < jobs.size(); i++) {
+    Job & job = jobs[i];
+    if(job.built || !job.parse.isFinished()) continue;
+
+    job.map->load(job.parse.result().data());
+    job.parse = QFuture < QSharedPointer < MapReader > >();
+    job.built = true;
+    startUploads(job);
+    MapCache::add(job.map);
+    break;
+  }
+
+  // TextureResidency uploads them as they finish decoding; a job is done once
+  // all of its textures are resident.
+  for(int i = jobs.size() - 1; i >= 0; i--) {
+    Job & job = jobs[i];
+    if(!job.built) continue;
+
+    for(int j = job.uploads.size() - 1; j >= 0; j--) {
+      if(job.uploads[j]->isUploaded()) job.uploads.removeAt(j);
+    }
+    if(job.uploads.isEmpty())
+      jobs.removeAt(i);
+    else
+      TextureResidency::preload(job.uploads);   // in case one was evicted meanwhile
+  }
+
+  if(teleportMap && isReady(teleportMap)) {
+    Map * map = teleportMap;
+    teleportMap = 0;
+    RPGEngine::setMap(mapnames[map->getName()]);
+    if(playerEntity) playerEntity->setPos(teleport_x, teleport_y);
+  }
+}
+
+QSharedPointer < MapReader > MapPreloader::parse(const QString & filename) {
+  QSharedPointer < MapReader > reader(new MapReader);
+
+  QString bmap = BinaryMap::binaryFile(filename);
+  if(bmap.isEmpty()) {
+    reader->parse(filename);
+  } else {
+    // Binary maps are memory mapped; read the file once so the pages are
+    // in the OS cache when the GUI thread maps it.
+    QFile f(bmap);
+    if(f.open(QIODevice::ReadOnly)) {
+      while(!f.read(1 << 20).isEmpty()) {}
+    }
+  }
+
+  return reader;
+}
+
+void MapPreloader::startUploads(Job & job) {
+  // Textures are never uploaded headless; a built map is ready.
+  if(headless) return;
+  QList < Bitmap * > needed = TextureResidency::bitmapsFor(job.map);
+  for(int i = 0; i < needed.size(); i++) {
+    if(!needed[i]->isUploaded()) job.uploads.append(needed[i]);
+  }
+  TextureResidency::preload(job.uploads);
+}
+
+int MapPreloader::findJob(Map * map) {
+  for(int i = 0; i < jobs.size(); i++) {
+    if(jobs[i].map == map) return i;
+  }
+  return -1;
+}
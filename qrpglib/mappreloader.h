@@ -0,0 +1,44 @@
+#ifndef MAPPRELOADER_H
+#define MAPPRELOADER_H 1
+
+#include <QtCore>
+
+class Map;
+class MapReader;
+class Bitmap;
+
+/* Gets a map ready before it is shown.  The file is parsed on the thread
+   pool; once that is done the map is built on the GUI thread and the
+   textures it needs are queued with TextureResidency, which decodes them on
+   the thread pool and uploads a few per frame.  The frame that flips to the
+   map does no I/O.  teleport() switches
+   as soon as the map is ready. */
+
+class MapPreloader {
+public:
+  static void preload(Map * map);
+  static bool isReady(Map * map);
+  static void teleport(Map * map, int x, int y);
+  static void forget(Map * map);
+
+  // Called once per game step by MapScene.
+  static void step();
+
+private:
+  struct Job {
+    Map * map;
+    QFuture < QSharedPointer < MapReader > > parse;
+    bool built;
+    QList < Bitmap * > uploads;
+  };
+
+  static QSharedPointer < MapReader > parse(const QString & filename);
+  static void startUploads(Job & job);
+  static int findJob(Map * map);
+
+  static QList < Job > jobs;
+  static Map * teleportMap;
+  static int teleport_x, teleport_y;
+};
+
+#endif
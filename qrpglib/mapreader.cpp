@@ -3,7 +3,11 @@
 #include "npc.h"
 #include "player.h"
 #include "entity.h"
+#include "globals.h"
+#include "tiledataparser.h"
+#include "binarymap.h"
 #include <QtCore>
+#include <string.h>
 
 void MapReader::tokenDebug()
 {
@@ -17,10 +21,44 @@ void MapReader::tokenDebug()
   }
 }
 
+MapReader::MapReader()
+{
+  hasMap = hasName = hasTileset = false;
+}
+
+MapReader::~MapReader()
+{
+  clearLayers();
+}
+
+// Frees tile buffers that create() didn't hand over.
+void MapReader::clearLayers()
+{
+  for(int i = 0; i < layers.size(); i++)
+    delete [] layers[i].tiles;
+  layers.clear();
+}
+
 Map * MapReader::read(QIODevice * device)
+{
+  parse(device);
+  return create();
+}
+
+Map * MapReader::read(QString filename)
+{
+  parse(filename);
+  return create();
+}
+
+bool MapReader::parse(QIODevice * device)
 {
   setDevice(device);
-  map = 0;
+  hasMap = hasName = hasTileset = false;
+  mapName = tilesetName = QString();
+  scripts.clear();
+  clearLayers();
+  errorText = QString();
 
   while (!atEnd()) {
     readNext();
@@ -33,23 +71,157 @@ Map * MapReader::read(QIODevice * device)
     }
   }
 
-  if(!error())
-    return map;
-  else
-    return 0;
+  if(error())
+    errorText = QString("line %1: %2").arg(lineNumber()).arg(errorString());
+  setDevice(0);
+  return !error();
 }
 
-Map * MapReader::read(QString filename)
+bool MapReader::parse(QString filename)
 {
   QFile f(filename);
   f.open(QIODevice::ReadOnly);
-  return read(&f);
+  bool ok = parse(&f);
+  if(!ok)
+    errorText = filename + ", " + errorText;
+  return ok;
+}
+
+Map * MapReader::create(Map * map)
+{
+  if(!errorText.isEmpty()) {
+    message(errorText);
+    return 0;
+  }
+  if(!hasMap)
+    return 0;
+
+  if(!map)
+    map = new Map();
+
+  if(hasName)
+    map->setName(mapName);
+  if(hasTileset)
+    map->setTileset(bitmaps[bitmapnames[tilesetName]]);
+
+  for(int i = 0; i < scripts.size(); i++)
+    map->addScript(scripts[i].condition, scripts[i].script);
+
+  for(int i = 0; i < layers.size(); i++) {
+    LayerData & l = layers[i];
+    QString layerName = l.name;
+    if(layerName.isEmpty())
+      layerName = "Layer " + QString::number(map->getLayerCount() + 1);
+
+    // The parsed buffer becomes the layer's own.
+    int layer;
+    if(l.tiles) {
+      layer = map->addLayer(l.width, l.height, l.tiles, layerName);
+      l.tiles = 0;
+    } else {
+      layer = map->addLayer(l.width, l.height, false, 0, layerName);
+    }
+
+    for(int j = 0; j < l.entities.size(); j++) {
+      EntityData & d = l.entities[j];
+
+      //qDebug() << "loading NPC " + d.name;
+      Entity * ePtr = new Npc(d.name);
+      EntityPointer e = ePtr->getSharedPointer();
+
+      if(d.sprite != "") {
+        e->setSprite(d.sprite);
+      } else {
+        e->setSprite(0);
+      }
+
+      e->setPos(d.x, d.y);
+      e->setState(d.state);
+      e->setBoundingBox(d.bx1, d.by1, d.bx2, d.by2);
+      e->setOverrideBoundingBox(d.overrideBoundingBox);
+      e->setInvisible(d.invisible);
+      e->setSolid(d.solid);
+
+      for(int k = 0; k < d.scripts.size(); k++) {
+        ScriptData & s = d.scripts[k];
+        e->addScript(s.condition, s.script, s.defCoords, s.x1, s.y1, s.x2, s.y2);
+      }
+
+      map->addStartEntity(layer, e);
+    }
+  }
+
+  // The parsed data is not needed any more.
+  scripts.clear();
+  clearLayers();
+  hasMap = false;
+
+  return map;
+}
+
+bool MapReader::peek(QString filename)
+{
+  hasMap = hasName = hasTileset = false;
+  mapName = tilesetName = QString();
+  fileName = filename;
+
+  QString bmap = BinaryMap::binaryFile(filename);
+  if(!bmap.isEmpty() && BinaryMap::peek(bmap, mapName, tilesetName)) {
+    hasMap = hasName = hasTileset = true;
+    return true;
+  }
+
+  QFile f(filename);
+  if(!f.open(QIODevice::ReadOnly))
+    return false;
+  setDevice(&f);
+
+  // <name> and <tileset> come before the layers in files Map::save writes.
+  while (!atEnd() && !(hasName && hasTileset)) {
+    readNext();
+    if (isStartElement()) {
+      if (name() == "map")
+        hasMap = true;
+      else if (name() == "layer")
+        break;
+      else if (name() == "name")
+      {
+        mapName = readElementText();
+        hasName = true;
+      }
+      else if (name() == "tileset")
+      {
+        tilesetName = readElementText();
+        hasTileset = true;
+      }
+    }
+  }
+
+  setDevice(0);
+  return hasMap;
+}
+
+Map * MapReader::createStub()
+{
+  if(!hasMap)
+    return 0;
+
+  Map * map = new Map();
+
+  if(hasName)
+    map->setName(mapName);
+  if(hasTileset)
+    map->setTileset(bitmaps[bitmapnames[tilesetName]]);
+  map->setSourceFile(QFileInfo(fileName).absoluteFilePath());
+
+  hasMap = false;
+  return map;
 }
 
 void MapReader::readMap()
 {
   Q_ASSERT(isStartElement() && name() == "map");
-  map = new Map();
+  hasMap = true;
 
   while (!atEnd()) {
     readNext();
@@ -61,8 +233,8 @@ void MapReader::readMap()
     if (isStartElement()) {
       if (name() == "name")
       {
-        map->setName(readElementText());
-        //message("Map name: " + map->GetName());
+        mapName = readElementText();
+        hasName = true;
       }
       else if (name() == "layer")
       {
@@ -70,7 +242,8 @@ void MapReader::readMap()
       }
       else if (name() == "tileset")
       {
-        map->setTileset(bitmaps[bitmapnames[readElementText()]]);
+        tilesetName = readElementText();
+        hasTileset = true;
       }
       else if (name() == "scripts")
       {
@@ -88,13 +261,9 @@ void MapReader::readLayer()
 {
   Q_ASSERT(isStartElement() && name() == "layer");
 
-  QString tileset;
-  QString layerName;
-  int h = 0;
-  int w = 0;
-  QList<int> layerData;
-  int currentLayer = 0;
-  QList< EntityPointer > entities;
+  LayerData layer;
+  layer.width = layer.height = 0;
+  layer.tiles = 0;
 
   while (!atEnd()) {
     readNext();
@@ -107,29 +276,34 @@ void MapReader::readLayer()
     if (isStartElement()) {
       if (name() == "width")
       {
-        w = readElementText().toInt();
+        layer.width = readElementText().toInt();
         //message("WIDTH: " + w);
       }
       else if (name() == "height")
       {
-        h = readElementText().toInt();
+        layer.height = readElementText().toInt();
         //message("HEIGHT: " + h);
       }
       else if (name() == "tileset")
       {
-        tileset = readElementText();
+        readElementText();
       }
       else if (name() == "name")
       {
-        layerName = readElementText();
+        layer.name = readElementText();
       }
       else if (name() == "layerdata")
       {
-        readLayerData(layerData);
+        // Tiles are parsed straight into the layer's buffer, so its size has to be known by now.
+        if(layer.width <= 0 || layer.height <= 0) {
+          raiseError(QObject::tr("<layerdata> must come after the layer's <width> and <height>"));
+          return;
+        }
+        readLayerData(layer);
       }
       else if (name() == "entities")
       {
-        readEntities(entities);
+        readEntities(layer.entities);
       }
       else
       {
@@ -138,42 +312,37 @@ void MapReader::readLayer()
     }
   }
 
-  if(layerName.isEmpty() || layerName.isNull())
-    currentLayer = map->addLayer(w, h, false, 0, "Layer " + QString::number(map->getLayerCount() + 1));
-  else
-    currentLayer = map->addLayer(w, h, false, 0, layerName);
-
-  for(int y = 0; y < h; y++)
-  {
-    for(int x = 0; x < w; x++)
-    {
-      int tile = layerData.takeFirst();
-      map->setTile(currentLayer, x, y, tile);
-    }
-  }
-
-  while(!(entities.isEmpty()))
-    map->addStartEntity(currentLayer, entities.takeFirst());
+  layers.append(layer);
 }
 
-void MapReader::readLayerData(QList<int> & layerData)
+void MapReader::readLayerData(LayerData & layer)
 {
   Q_ASSERT(isStartElement() && name() == "layerdata");
 
-  QString dataString = readElementText();
-  QTextStream data(&dataString);
+  // The parser writes every tile or fails the map, so the buffer isn't
+  // cleared first.
+  delete [] layer.tiles;
+  layer.tiles = new int[layer.width * layer.height];
+  TileDataParser parser(layer.tiles, layer.width, layer.height);
 
-  while(!data.atEnd())
-  {
-    int t = 0;
-    data.skipWhiteSpace();
-    data >> t;
-    data.skipWhiteSpace();
-    layerData.push_back(t);
+  while (!atEnd()) {
+    readNext();
+
+    if (isCharacters()) {
+      if(!parser.feed(text())) break;
+    } else if (isEndElement()) {
+      parser.finish();
+      break;
+    } else if (isStartElement()) {
+      readUnknownElement();
+    }
   }
+
+  if(!parser.errorString().isEmpty())
+    raiseError(parser.errorString());
 }
 
-void MapReader::readEntities(QList < EntityPointer > & entities) {
+void MapReader::readEntities(QList < EntityData > & entities) {
   while (!atEnd()) {
     readNext();
     //message("readLayer: Token (" + tokenString() + "): " + name().toString());
@@ -185,9 +354,7 @@ void MapReader::readEntities(QList < EntityPointer > & entities) {
     if (isStartElement()) {
       if (name() == "entity")
       {
-        EntityPointer e = readEntity();
-
-        entities.append(e);
+        entities.append(readEntity());
       }
       else
       {
@@ -197,51 +364,22 @@ void MapReader::readEntities(QList < EntityPointer > & entities) {
   }
 }
 
-EntityPointer MapReader::readEntity() {
-  QString ename = attributes().value("name").toString();
-  QString sprite = attributes().value("sprite").toString();
-  int x = attributes().value("x").toString().toInt();
-  int y = attributes().value("y").toString().toInt();
-  int state = attributes().value("state").toString().toInt();
-
-  int bx1 = attributes().value("bx1").toString().toInt();
-  int by1 = attributes().value("by1").toString().toInt();
-  int bx2 = attributes().value("bx2").toString().toInt();
-  int by2 = attributes().value("by2").toString().toInt();
-
-  int overrideboundingbox = attributes().value("overrideboundingbox").toString().toInt();
-  int invisible = attributes().value("invisible").toString().toInt();
-  int solid = attributes().value("solid").toString().toInt();
-
-  //qDebug() << "loading NPC " + ename;
-  Entity * ePtr = new Npc(ename);
-  EntityPointer e = ePtr->getSharedPointer();
-
-  if(sprite != "") {
-    e->setSprite(sprite);
-  } else {
-    e->setSprite(0);
-  }
-
+MapReader::EntityData MapReader::readEntity() {
+  EntityData e;
+  e.name = attributes().value("name").toString();
+  e.sprite = attributes().value("sprite").toString();
+  e.x = attributes().value("x").toString().toInt();
+  e.y = attributes().value("y").toString().toInt();
+  e.state = attributes().value("state").toString().toInt();
 
-  e->setPos(x, y);
-  e->setState(state);
-  e->setBoundingBox(bx1, by1, bx2, by2);
+  e.bx1 = attributes().value("bx1").toString().toInt();
+  e.by1 = attributes().value("by1").toString().toInt();
+  e.bx2 = attributes().value("bx2").toString().toInt();
+  e.by2 = attributes().value("by2").toString().toInt();
 
-  if(overrideboundingbox)
-    e->setOverrideBoundingBox(true);
-  else
-    e->setOverrideBoundingBox(false);
-
-  if(invisible)
-    e->setInvisible(true);
-  else
-    e->setInvisible(false);
-
-  if(solid)
-    e->setSolid(true);
-  else
-    e->setSolid(false);
+  e.overrideBoundingBox = attributes().value("overrideboundingbox").toString().toInt();
+  e.invisible = attributes().value("invisible").toString().toInt();
+  e.solid = attributes().value("solid").toString().toInt();
 
   while (!atEnd()) {
     readNext();
@@ -262,12 +400,10 @@ EntityPointer MapReader::readEntity() {
     }
   }
 
-  //qDebug() << "return entity";
-
   return e;
 }
 
-void MapReader::readEntityScripts(EntityPointer e) {
+void MapReader::readEntityScripts(EntityData & e) {
   while (!atEnd()) {
     readNext();
     tokenDebug();
@@ -278,19 +414,19 @@ void MapReader::readEntityScripts(EntityPointer e) {
     if (isStartElement()) {
       if (name() == "script")
       {
-        int condition = attributes().value("condition").toString().toInt();
-        bool defCoords = !(attributes().hasAttribute("x1"));
-        int x1, y1, x2, y2;
-        x1 = y1 = x2 = y2 = 0;
-        if(!defCoords) {
-          x1 = attributes().value("x1").toString().toInt();
-          y1 = attributes().value("y1").toString().toInt();
-          x2 = attributes().value("x2").toString().toInt();
-          y2 = attributes().value("y2").toString().toInt();
+        ScriptData s;
+        s.condition = attributes().value("condition").toString().toInt();
+        s.defCoords = !(attributes().hasAttribute("x1"));
+        s.x1 = s.y1 = s.x2 = s.y2 = 0;
+        if(!s.defCoords) {
+          s.x1 = attributes().value("x1").toString().toInt();
+          s.y1 = attributes().value("y1").toString().toInt();
+          s.x2 = attributes().value("x2").toString().toInt();
+          s.y2 = attributes().value("y2").toString().toInt();
         }
-        QString script = readElementText();
+        s.script = readElementText();
 
-        e->addScript(condition, script, defCoords, x1, y1, x2, y2);
+        e.scripts.append(s);
       }
       else
       {
@@ -312,10 +448,13 @@ void MapReader::readScripts()
     if (isStartElement()) {
       if (name() == "script")
       {
-        int condition = attributes().value("condition").toString().toInt();
-        QString script = readElementText();
+        ScriptData s;
+        s.condition = attributes().value("condition").toString().toInt();
+        s.script = readElementText();
+        s.defCoords = true;
+        s.x1 = s.y1 = s.x2 = s.y2 = 0;
 
-        map->addScript(condition, script);
+        scripts.append(s);
       }
       else
       {
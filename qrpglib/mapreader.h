@@ -2,31 +2,79 @@
 #define MAPREADER_H
 
 #include <QtCore>
+#include "map.h"
 
-class Map;
 class Entity;
 
 typedef QSharedPointer<Entity> EntityPointer;
 
+/* Reading a map is split in two so that projects can parse their maps on
+   worker threads: parse() only fills the reader's own data and touches no
+   globals, create() builds and registers the Map and its entities and must
+   run on the GUI thread.  read() does both. */
+
 class MapReader : public QXmlStreamReader
 {
 public:
+  MapReader();
+  ~MapReader();
+
   Map * read(QIODevice * device);
   Map * read(QString filename);
 
+  bool parse(QIODevice * device);
+  bool parse(QString filename);
+  Map * create(Map * map = 0);
+
+  // Reads just the name and tileset and registers an unloaded Map that
+  // fills itself in from the file when first shown.
+  bool peek(QString filename);
+  Map * createStub();
+
 private:
+  struct ScriptData {
+    int condition;
+    QString script;
+    bool defCoords;
+    int x1, y1, x2, y2;
+  };
+
+  struct EntityData {
+    QString name;
+    QString sprite;
+    int x, y, state;
+    int bx1, by1, bx2, by2;
+    bool overrideBoundingBox, invisible, solid;
+    QList < ScriptData > scripts;
+  };
+
+  struct LayerData {
+    int width, height;
+    QString name;
+    // Allocated by the parser and handed over to the Layer by create().
+    int * tiles;
+    QList < EntityData > entities;
+  };
+
   void readMap();
   void readLayer();
-  void readLayerData(QList<int> & layerData);
-  void readEntities(QList < EntityPointer > & entities);
-  EntityPointer readEntity();
-  void readEntityScripts(EntityPointer e);
+  void readLayerData(LayerData & layer);
+  void readEntities(QList < EntityData > & entities);
+  EntityData readEntity();
+  void readEntityScripts(EntityData & e);
   void readScripts();
 
   void readUnknownElement();
   void tokenDebug();
+  void clearLayers();
 
-  Map * map;
+  bool hasMap, hasName, hasTileset;
+  QString mapName;
+  QString tilesetName;
+  QList < ScriptData > scripts;
+  QList < LayerData > layers;
+  QString errorText;
+  QString fileName;
 };
 
 #endif // MAPREADER_H
@@ -2,6 +2,7 @@
 #include "map.h"
 #include "newmapdialog.h"
 #include "globals.h"
+#include "tiledataparser.h"
 #include <QtCore>
 
 void MapReaderTiled::tokenDebug()
@@ -25,7 +26,7 @@ Map * MapReaderTiled::read(QIODevice * device)
 
   while (!atEnd()) {
     readNext();
-    qDebug() << ("read: Token (" + tokenString() + "): " + name().toString());
+    //qDebug() << ("read: Token (" + tokenString() + "): " + name().toString());
     if (isStartElement()) {
       if (name() == "map")
         readMap();
@@ -61,7 +62,7 @@ void MapReaderTiled::readMap()
 
   while (!atEnd()) {
     readNext();
-    qDebug() << ("readMap: Token (" + tokenString() + "): " + name().toString());
+    //qDebug() << ("readMap: Token (" + tokenString() + "): " + name().toString());
 
     if (isEndElement())
       break;
@@ -86,7 +87,6 @@ void MapReaderTiled::readLayer()
   QString layerName;
   int h = 0;
   int w = 0;
-  QList<int> layerData;
   int currentLayer = 0;
   QList< EntityPointer > entities;
 
@@ -94,9 +94,15 @@ void MapReaderTiled::readLayer()
   h = attributes().value("height").toString().toInt();
   layerName = attributes().value("name").toString();
 
+  // The size is known up front, so create the layer now and read the tiles into it.
+  if(layerName.isEmpty() || layerName.isNull())
+    currentLayer = map->addLayer(w, h, false, 0, "Layer " + QString::number(map->getLayerCount() + 1));
+  else
+    currentLayer = map->addLayer(w, h, false, 0, layerName);
+
   while (!atEnd()) {
     readNext();
-    qDebug() << ("readLayer: Token (" + tokenString() + "): " + name().toString() + " " + layerName);
+    //qDebug() << ("readLayer: Token (" + tokenString() + "): " + name().toString() + " " + layerName);
     tokenDebug();
 
     if (isEndElement())
@@ -105,7 +111,7 @@ void MapReaderTiled::readLayer()
     if (isStartElement()) {
       if (name() == "data")
       {
-        readLayerData(layerData);
+        readLayerData(map->getLayer(currentLayer));
       }
       else
       {
@@ -114,42 +120,38 @@ void MapReaderTiled::readLayer()
     }
   }
 
-  if(layerName.isEmpty() || layerName.isNull())
-    currentLayer = map->addLayer(w, h, false, 0, "Layer " + QString::number(map->getLayerCount() + 1));
-  else
-    currentLayer = map->addLayer(w, h, false, 0, layerName);
-
-  for(int y = 0; y < h; y++)
-  {
-    for(int x = 0; x < w; x++)
-    {
-      int tile = layerData.takeFirst();
-      map->setTile(currentLayer, x, y, tile);
-    }
-  }
-
   while(!(entities.isEmpty()))
     map->addStartEntity(currentLayer, entities.takeFirst());
 }
 
-void MapReaderTiled::readLayerData(QList<int> & layerData)
+void MapReaderTiled::readLayerData(Map::Layer * layer)
 {
   Q_ASSERT(isStartElement() && name() == "data");
 
+  // Tiles come either as one <tile gid="..."/> element each, or as CSV text.
+  TileDataParser parser(layer->layerdata, layer->width, layer->height);
+  parser.setTiledGids(true);
+  QString emptyTile("0");
+
   while (!atEnd()) {
     readNext();
     //qDebug() << ("readLayerData: Token (" + tokenString() + "): " + name().toString());
-    tokenDebug();
 
-    if (isEndElement() && name() == "data")
+    if (isEndElement() && name() == "data") {
+      parser.finish();
       break;
+    }
 
-    if (isStartElement()) {
+    if (isCharacters()) {
+      if(!parser.feed(text())) break;
+    } else if (isStartElement()) {
       if (name() == "tile")
       {
-        int tile = 0;
-        tile = attributes().value("gid").toString().toInt();
-        layerData.push_back(tile);
+        // A tile without a gid is empty.
+        QStringRef gid = attributes().value("gid");
+        if(gid.isEmpty()) gid = QStringRef(&emptyTile);
+        if(!parser.feed(gid) || !parser.endValue()) break;
+        readUnknownElement();
       }
       else
       {
@@ -157,6 +159,9 @@ void MapReaderTiled::readLayerData(QList<int> & layerData)
       }
     }
   }
+
+  if(!parser.errorString().isEmpty())
+    raiseError(parser.errorString());
 }
 
 void MapReaderTiled::readUnknownElement()
@@ -165,7 +170,7 @@ void MapReaderTiled::readUnknownElement()
 
   while (!atEnd()) {
     readNext();
-    qDebug() << ("readUnknownElement: Token (" + tokenString() + "): " + name().toString());
+    //qDebug() << ("readUnknownElement: Token (" + tokenString() + "): " + name().toString());
 
     if (isEndElement())
       break;
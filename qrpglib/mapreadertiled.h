@@ -2,8 +2,8 @@
 #define MAPREADERTILED_H
 
 #include <QtCore>
+#include "map.h"
 
-class Map;
 class Entity;
 
 typedef QSharedPointer<Entity> EntityPointer;
@@ -17,7 +17,7 @@ public:
 private:
   void readMap();
   void readLayer();
-  void readLayerData(QList<int> & layerData);
+  void readLayerData(Map::Layer * layer);
 
   void readUnknownElement();
   void tokenDebug();
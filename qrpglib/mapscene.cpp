@@ -22,6 +22,11 @@
 #include "rpgscript.h"
 #include "mapscene.h"
 #include "scriptutils.h"
+#include "tilebatch.h"
+#include "textureresidency.h"
+#include "mapundo.h"
+#include "profiler.h"
+#include "trace.h"
 
 using std::cout;
 
@@ -169,6 +174,20 @@ void MapScene::setSceneRect(const QRectF &rect) {
 
 }
 
+// One fixed-rate simulation step, driven by GameLoop.
+void MapScene::step() {
+  if(input->menu) {
+    emit menuKey();
+    input->menu = false;
+  }
+  if(input->console) {
+    console->setVisible(!(console->isVisible()));
+    input->console = false;
+  }
+
+  RPGEngine::step();
+}
+
 void MapScene::drawBackground(QPainter *painter, const QRectF &) {
   /*
   if (painter->paintEngine()->type() != QPaintEngine::OpenGL) {
@@ -178,80 +197,29 @@ void MapScene::drawBackground(QPainter *painter, const QRectF &) {
   */
   if(frames == 0) init(screen_x, screen_y);
   frames++;
+  Profiler::endFrame();
+  Profiler::begin(Profiler::Paint);
+  TileBatch::endFrame();
+  TextureResidency::beginFrame();
   painter->save();
   painter->setPen(QColor(255, 255, 255));
   painter->setFont(*mapFont);
 
-  // GAME ENGINE LOOP
   if(play) {
     setFocus();
     framesThisSecond++;
 
-    /*
-    if(input->up) mapBox->Move(0, -1);
-    if(input->down) mapBox->Move(0, 1);
-    if(input->left) mapBox->Move(-1, 0);
-    if(input->right) mapBox->Move(1, 0);
-    */
-
-    if(input->menu) {
-      emit menuKey();
-      input->menu = false;
-    }
-    if(input->action) playerEntity->setActivated(true);
-    if(input->console) {
-      console->setVisible(!(console->isVisible()));
-      input->console = false;
-    }
-
-    if(rpgEngineStarting) {
-      scriptUtils->include("scripts/startup.js");
-    }
-
-    // Global scripts.
-    for(int i = 0; i < globalScripts.size(); i++) {
-      bool execute = false;
-      RPGScript * s = &(globalScripts[i]);
-      if(rpgEngineStarting && s->condition == ScriptCondition::Load) {
-        execute = true;
-      } else if(s->condition == ScriptCondition::EveryFrame) {
-        execute = true;
-      }
-
-      if(execute) {
-        scriptEngine->evaluate(s->script);
-
-        if(scriptEngine->hasUncaughtException())
-          message(scriptEngine->uncaughtException().toString());
-      }
-    }
-
-    rpgEngineStarting = false;
-
-    if(mapBox->map) mapBox->map->update();
-
-    playerEntity->setActivated(false);
-
+    // Follow the camera at its interpolated position between simulation steps.
     if(mapBox->getCamera()) {
-      mapBox->setX(mapBox->getCamera()->getX() - screen_x / 2);
-      mapBox->setY(mapBox->getCamera()->getY() - screen_y / 2);
+      mapBox->xo = (int) mapBox->getCamera()->getDrawX() - screen_x / 2;
+      mapBox->yo = (int) mapBox->getCamera()->getDrawY() - screen_y / 2;
+      mapBox->clampOrigin();
     }
 
-    // TODO: make this handle pauses
-    int e = apptime.elapsed();
-    timeSinceLastFrame = e - timeLastFrame;
-    timeLastFrame = e;
-
     if(fpstime.elapsed() >= 1000) {
-      /*fpsLabel->setText(QString("%1 %4 (%2, %3)")
-        .arg(framesThisSecond).arg(mapBox->xo).arg(mapBox->yo).arg(mapBox->GetMap()->GetName())); */
-      //fpsLabel->setText(QString::number(framesThisSecond) + " / " +
-      //                  QString::number(mapBox->xo) + ", " + QString::number(mapBox->yo));
       framesThisSecond = 0;
       fpstime.restart();
     }
-    //fpsLabel->repaint();
-    input->action = false;
   }
 
   int i;
@@ -319,6 +287,9 @@ void MapScene::drawBackground(QPainter *painter, const QRectF &) {
     gluOrtho2D(0, thisWidth, thisHeight, 0);
     */
 
+    Profiler::begin(Profiler::MapDraw);
+    TraceScope trace("draw layers", "draw");
+    if(Trace::isRecording()) trace.setArgs(Trace::args("map", mapBox->map->getName()));
     for(i = 0; i < mapBox->map->getLayerCount(); i++) {
       //message("drawing layer " + QString::number(i));
       if(i == mapBox->layer) {
@@ -361,6 +332,7 @@ void MapScene::drawBackground(QPainter *painter, const QRectF &) {
         mapBox->map->draw(i, x, y, opacity);
       }
     }
+    Profiler::end(Profiler::MapDraw);
     sceneBuffer->release();
     //static_cast<QGLWidget *>(mapBox->viewport())->makeCurrent();
     //glPopMatrix();
@@ -377,6 +349,7 @@ void MapScene::drawBackground(QPainter *painter, const QRectF &) {
 
     glEnable(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, sceneBuffer->texture());
+    TileBatch::resetBinding();
     glEnable(GL_BLEND);   // Turn Blending On
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -420,8 +393,31 @@ void MapScene::drawBackground(QPainter *painter, const QRectF &) {
 
 //#if QT_VERSION < 0x040600
   //if(is_editor) QTimer::singleShot(20, this, SLOT(update()));
-  update(this->sceneRect());
+  // Edit mode repaints on demand through MapBox::requestRepaint().
+  mapBox->lastRepaint.restart();
 //#endif
+
+  // The view paints the scene's items next; drawForeground closes the span.
+  Profiler::begin(Profiler::Overlay);
+}
+
+void MapScene::drawForeground(QPainter * painter, const QRectF &) {
+  Profiler::end(Profiler::Overlay);
+  if(Profiler::hasOverlay()) drawProfiler(painter);
+  Profiler::end(Profiler::Paint);
+}
+
+void MapScene::drawProfiler(QPainter * painter) {
+  QRect r(5, 5, 260, height() - 10);
+  QString text = Profiler::overlayText();
+
+  painter->save();
+  painter->setFont(*mapFont);
+  QRect bounds = painter->boundingRect(r, Qt::AlignLeft | Qt::AlignTop, text);
+  painter->fillRect(bounds.adjusted(-3, -3, 3, 3), QColor(0, 0, 0, 160));
+  painter->setPen(QColor(255, 255, 255));
+  painter->drawText(r, Qt::AlignLeft | Qt::AlignTop, text);
+  painter->restore();
 }
 
 void MapScene::editEntity() {
@@ -478,11 +474,12 @@ void MapScene::newEntity() {
   e->setSprite(0);
   e->setPos(mouseScenePos.x(), mouseScenePos.y());
   e->addToMap(mapBox->layer);
+  MapUndo::addEntity(e);
   emit showEntityDialog(e);
 }
 
 void MapScene::deleteEntity() {
-  selectedEntity->destroy();
+  MapUndo::deleteEntity(selectedEntity);
 }
 
 void MapScene::drawGrid(int layer, QPainter * painter, int tw, int th) {
@@ -600,6 +597,7 @@ void MapScene::drawNumbers(int layer, QPainter * painter, int tw, int th) {
 void MapScene::mousePressEvent(QGraphicsSceneMouseEvent * e) {
   //qDebug() << "MapScene::mousePressEvent";
   //setFocus(Qt::MouseFocusReason);
+  mapBox->requestRepaint();
   QGraphicsScene::mousePressEvent(e);
   if(e->isAccepted()) return;
   //e->accept();
@@ -627,6 +625,7 @@ void MapScene::mousePressEvent(QGraphicsSceneMouseEvent * e) {
 
   if(mapBox->mapEditorMode == MapEditorMode::Edit && mapBox->map && e->button() == Qt::LeftButton) {
     if(paintMode == PaintMode::Draw && !play) {
+      MapUndo::beginTiles(mapBox->map, mapBox->getCurrentLayer(), "Paint");
       mapBox->setTile(e);
     } else if(paintMode == PaintMode::SelectBox) {
       if(mouseInsideSelection(e)) {
@@ -640,6 +639,7 @@ void MapScene::mousePressEvent(QGraphicsSceneMouseEvent * e) {
           selection->stamp(mapBox->getCurrentLayer(),selectBox.x(), selectBox.y());
           delete selection;
           selection = 0;
+          MapUndo::endTiles();
         }
 
         selectBox = QRect();
@@ -665,7 +665,9 @@ void MapScene::mousePressEvent(QGraphicsSceneMouseEvent * e) {
       mapBox->map->getTileSize(w, h);
       x = (mapBox->xo + mouseStartX) / w;
       y = (mapBox->yo + mouseStartY) / h;
+      MapUndo::beginTiles(mapBox->map, mapBox->getCurrentLayer(), "Fill");
       fill(mapBox->layer, x, y, mapBox->currentTile);
+      MapUndo::endTiles();
     }
     //qDebug() << "  set tile";
   } else if(mapBox->mapEditorMode == MapEditorMode::Entity &&
@@ -674,6 +676,7 @@ void MapScene::mousePressEvent(QGraphicsSceneMouseEvent * e) {
     int mouseY = mouseStartY + mapBox->yo;
     mapBox->dragEntity = mapBox->entityAt(mouseX, mouseY);
     if(mapBox->dragEntity) {
+      MapUndo::beginEntityEdit(mapBox->dragEntity);
       mapBox->resizeDirection = mapBox->edgeAt(mapBox->dragEntity, mouseX, mouseY);
       /*
       double x1, y1, x2, y2;
@@ -729,6 +732,8 @@ void MapScene::mousePressEvent(QGraphicsSceneMouseEvent * e) {
 
 void MapScene::mouseMoveEvent(QGraphicsSceneMouseEvent * e) {
   //qDebug() << "MapScene::mouseMoveEvent";
+  // Also moves the tile highlight.
+  mapBox->requestRepaint();
 
   if(mapBox->map) {
     int tx, ty;
@@ -878,6 +883,7 @@ void MapScene::dropEvent(QGraphicsSceneDragDropEvent *event) {
 
 void MapScene::mouseDoubleClickEvent(QGraphicsSceneMouseEvent * e) {
   //qDebug() << "MapScene::mouseDoubleClickEvent";
+  mapBox->requestRepaint();
   QGraphicsScene::mouseDoubleClickEvent(e);
   if(e->isAccepted()) return;
 
@@ -891,6 +897,12 @@ void MapScene::mouseDoubleClickEvent(QGraphicsSceneMouseEvent * e) {
 }
 
 void MapScene::mouseReleaseEvent(QGraphicsSceneMouseEvent * e) {
+  // Each stroke or drag is one undo step.  A floating selection keeps
+  // recording until it is dropped.
+  if(!(paintMode == PaintMode::SelectBox && selection)) MapUndo::endTiles();
+  MapUndo::endEntityEdit();
+  mapBox->requestRepaint();
+
   QGraphicsScene::mouseReleaseEvent(e);
 
   if(e->isAccepted()) return;
@@ -948,6 +960,9 @@ void MapScene::keyEvent(int key, int eventType) {
     case Qt::Key_Space:
       input->action = (eventType == QEvent::KeyPress);
       break;
+    case Qt::Key_F3:
+      if(eventType == QEvent::KeyPress) Profiler::setOverlay(!Profiler::hasOverlay());
+      break;
     case Qt::Key_F5:
       if(eventType == QEvent::KeyPress) console->clear();
       break;
@@ -973,44 +988,16 @@ void MapScene::keyReleaseEvent(QKeyEvent * event) {
   keyEvent(event->key(), QEvent::KeyRelease);
 }
 
-void MapScene::fill(int layer, int x, int y, int tile, int firstTile)  {
-  int w, h;
-  mapBox->map->getSize(layer, w, h);
-  if(x < 0 || y < 0 || x >= w || y >= h) {
-    return;
-  }
-
-  /*  int x1, y1, x2, y2;
-  x1 = selectBox.x();
-  y1 = selectBox.y();
-  x2 = x1 + selectBox.width();
-  y2 = y1 + selectBox.height();
-
-  if(x2 < x1) std::swap(x1, x2);
-  if(y2 < y1) std::swap(y1, y2);
-
-  if((selectBox.width() != 0 || selectBox.height != 0) &&
-     (x < x1 || y < x1 || x > select))
-  */
-
-  if((selectBox.width() != 0 && selectBox.height() != 0) &&
-     (!(selectBox.contains(x, y, false)))) {
-    return;
-  }
-
-  if(firstTile == -1) {
-    firstTile = mapBox->map->getTile(layer, x, y);
-  }
+void MapScene::fill(int layer, int x, int y, int tile)  {
+  Map::Layer * l = mapBox->map->getLayer(layer);
+  if(!l) return;
 
-  if(tile == firstTile) return;
+  // An active selection box limits the fill.
+  QRect clip;
+  if(selectBox.width() != 0 && selectBox.height() != 0)
+    clip = selectBox;
 
-  if(mapBox->map->getTile(layer, x, y) == firstTile) {
-    mapBox->map->setTile(layer, x, y, tile);
-    fill(layer, x + 1, y, tile, firstTile);
-    fill(layer, x - 1, y, tile, firstTile);
-    fill(layer, x, y + 1, tile, firstTile);
-    fill(layer, x, y - 1, tile, firstTile);
-  }
+  l->floodFill(x, y, tile, clip);
 }
 
 bool MapScene::mouseInsideSelection(QGraphicsSceneMouseEvent * e) {
@@ -1033,15 +1020,11 @@ void MapScene::cutSelection() {
   copySelection();
   selection->clear();
   selectBox = QRect();
+  mapBox->requestRepaint();
 }
 
 void MapScene::pasteSelection() {
-  if(selection) {
-    selection->stamp(mapBox->getCurrentLayer(), selectBox.x(), selectBox.y());
-
-    delete selection;
-    selection = 0;
-  }
+  commitSelection();
 
   int x, y;
   getMouseTileCoords(x, y);
@@ -1051,10 +1034,25 @@ void MapScene::pasteSelection() {
 
   selection = new Map::Layer(clipboard);
   selectBox = QRect(x, y, selection->width, selection->height);
+  MapUndo::beginTiles(mapBox->map, mapBox->getCurrentLayer(), "Paste");
+  mapBox->requestRepaint();
+}
+
+// Drops a floating selection onto the layer and closes its undo step.
+void MapScene::commitSelection() {
+  if(selection) {
+    selection->stamp(mapBox->getCurrentLayer(), selectBox.x(), selectBox.y());
+
+    delete selection;
+    selection = 0;
+    mapBox->requestRepaint();
+  }
+  MapUndo::endTiles();
 }
 
 void MapScene::deleteSelection() {
   selection->clear();
+  mapBox->requestRepaint();
 }
 
 void MapScene::copySelection() {
@@ -1079,6 +1077,8 @@ void MapScene::selectNone() {
     delete selection;
     selection = 0;
   }
+  MapUndo::endTiles();
+  mapBox->requestRepaint();
 }
 
 void MapScene::updateSelection() {
@@ -1110,12 +1110,14 @@ void MapScene::updateSelection() {
 
   //qDebug() << "Normalized: " << selectBox;
   Map::Layer * currentLayer = mapBox->getCurrentLayer();
+  MapUndo::beginTiles(mapBox->map, currentLayer, "Move Selection");
   selection = new Map::Layer(currentLayer,
                         selectBox.x(), selectBox.y(),
                         selectBox.width(), selectBox.height());
   currentLayer->fillArea(selectBox.x(), selectBox.y(),
                          selectBox.width(), selectBox.height(), 0);
   //selection->dump();
+  mapBox->requestRepaint();
 }
 
 void MapScene::getMouseTileCoords(int &x, int &y) {
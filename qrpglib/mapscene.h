@@ -17,6 +17,8 @@ public:
 
   MapScene(MapBox * m);
   void drawBackground(QPainter *painter, const QRectF &rect);
+  void drawForeground(QPainter *painter, const QRectF &rect);
+  void step();
   void init(int w, int h);
   void drawGrid(int layer, QPainter *painter, int tw, int th);
   void drawEntityNames(int layer, QPainter *painter);
@@ -24,6 +26,7 @@ public:
   void drawSelectBox(int layer, QPainter *painter, int tw, int th);
   void drawTileHighlight(QPainter *painter, int tw, int th);
   void drawFloatingLayer(Map::Layer * layer, QRect rect, int xo, int yo, int tw, int th);
+  void drawProfiler(QPainter *painter);
   void getMouseTileCoords(int &x, int &y);
   void setSceneRect (const QRectF & rect);
 
@@ -59,13 +62,14 @@ public slots:
 
   void cutSelection();
   void pasteSelection();
+  void commitSelection();
   void deleteSelection();
   void copySelection();
   void selectAll();
   void selectNone();
   void addItem(QGraphicsItem *item);
 
-  void fill(int layer, int x, int y, int tile, int firstTile = -1);
+  void fill(int layer, int x, int y, int tile);
 
 signals:
   void showPropertyEditor(ObjectPointer);
@@ -0,0 +1,360 @@
+#include "mapundo.h"
+#include "globals.h"
+
+QUndoStack * MapUndo::stack = 0;
+Map * MapUndo::stackMap = 0;
+Map * MapUndo::pendingMap = 0;
+Map::Layer * MapUndo::pendingLayer = 0;
+TileDiff * MapUndo::pendingDiff = 0;
+QString MapUndo::pendingText;
+EntityPointer MapUndo::pendingEntity;
+QPointF MapUndo::pendingPos;
+QRect MapUndo::pendingBox;
+
+TileDiff::TileDiff() {
+}
+
+void TileDiff::capture(Map::Layer * l, int x, int y, int n) {
+  if(y < 0 || y >= l->height) return;
+  if(x < 0) { n += x; x = 0; }
+  n = qMin(n, l->width - x);
+  if(n <= 0) return;
+
+  Run r;
+  r.x = x;
+  r.y = y;
+  r.length = n;
+  encode(l, x, y, n, r.before);
+  runs.append(r);
+  bounds |= QRect(x, y, n, 1);
+}
+
+void TileDiff::finish(Map::Layer * l) {
+  for(int i = 0; i < runs.size(); i++) {
+    encode(l, runs[i].x, runs[i].y, runs[i].length, runs[i].after);
+  }
+}
+
+// Runs may overlap when a cell is written twice, so undo replays them
+// newest first and redo oldest first.
+void TileDiff::apply(Map::Layer * l, bool undo) const {
+  if(undo) {
+    for(int i = runs.size() - 1; i >= 0; i--) decode(l, runs[i].x, runs[i].y, runs[i].before);
+  } else {
+    for(int i = 0; i < runs.size(); i++) decode(l, runs[i].x, runs[i].y, runs[i].after);
+  }
+  l->invalidate(bounds.x(), bounds.y(), bounds.width(), bounds.height());
+}
+
+bool TileDiff::isEmpty() const {
+  return runs.isEmpty();
+}
+
+qint64 TileDiff::memoryUsage() const {
+  qint64 total = sizeof(TileDiff) + runs.size() * sizeof(Run);
+  for(int i = 0; i < runs.size(); i++) {
+    total += (runs[i].before.size() + runs[i].after.size()) * sizeof(int);
+  }
+  return total;
+}
+
+void TileDiff::encode(Map::Layer * l, int x, int y, int n, QVector < int > & out) {
+  out.clear();
+  int i = 0;
+  while(i < n) {
+    int value = l->tileAt(x + i, y);
+    int count = 1;
+    while(i + count < n && l->tileAt(x + i + count, y) == value) count++;
+    out << value << count;
+    i += count;
+  }
+}
+
+void TileDiff::decode(Map::Layer * l, int x, int y, const QVector < int > & values) {
+  if(l->sparse) {
+    for(int i = 0; i < values.size(); i += 2) {
+      for(int j = 0; j < values[i + 1]; j++) l->setTileAt(x++, y, values[i]);
+    }
+    return;
+  }
+
+  l->detach();
+  int * row = l->layerdata + x + y * l->width;
+  for(int i = 0; i < values.size(); i += 2) {
+    for(int j = 0; j < values[i + 1]; j++) *row++ = values[i];
+  }
+}
+
+// Commands built after the edit already happened skip their first redo(),
+// which QUndoStack::push() calls straight away.
+
+class TileEditCommand : public QUndoCommand {
+public:
+  TileEditCommand(Map * m, Map::Layer * l, TileDiff * d, QString text)
+    : QUndoCommand(text), map(m), layer(l), diff(d), bytes(d->memoryUsage()), skip(true) {
+    totalBytes += bytes;
+    commands.append(this);
+  }
+  ~TileEditCommand() {
+    expire();
+    commands.removeOne(this);
+  }
+
+  void undo() {
+    if(diff && map->indexOfLayer(layer) >= 0) diff->apply(layer, true);
+  }
+
+  void redo() {
+    if(skip) {
+      skip = false;
+      return;
+    }
+    if(diff && map->indexOfLayer(layer) >= 0) diff->apply(layer, false);
+  }
+
+  void expire() {
+    if(!diff) return;
+    totalBytes -= bytes;
+    delete diff;
+    diff = 0;
+  }
+
+  bool isExpired() const { return !diff; }
+
+  // Every live command, oldest first, and what their diffs hold.
+  static QList < TileEditCommand * > commands;
+  static qint64 totalBytes;
+
+private:
+  Map * map;
+  Map::Layer * layer;
+  TileDiff * diff;
+  qint64 bytes;
+  bool skip;
+};
+
+QList < TileEditCommand * > TileEditCommand::commands;
+qint64 TileEditCommand::totalBytes = 0;
+
+// Inserts or removes a layer.  The command owns the layer while it is out
+// of the map.
+class LayerCommand : public QUndoCommand {
+public:
+  LayerCommand(Map * m, int i, Map::Layer * l, bool insert)
+    : QUndoCommand(insert ? "Add Layer" : "Delete Layer"),
+      map(m), index(i), layer(l), inserting(insert), owned(insert) {}
+  ~LayerCommand() { if(owned) delete layer; }
+
+  void undo() { inserting ? take() : put(); }
+  void redo() { inserting ? put() : take(); }
+
+private:
+  void put() {
+    map->insertLayer(index, layer);
+    owned = false;
+  }
+
+  void take() {
+    map->takeLayer(index);
+    owned = true;
+  }
+
+  Map * map;
+  int index;
+  Map::Layer * layer;
+  bool inserting, owned;
+};
+
+class LayerMoveCommand : public QUndoCommand {
+public:
+  LayerMoveCommand(Map * m, int f, int t)
+    : QUndoCommand("Move Layer"), map(m), from(f), to(t) {}
+
+  void undo() { map->moveLayer(to, from); }
+  void redo() { map->moveLayer(from, to); }
+
+private:
+  Map * map;
+  int from, to;
+};
+
+class EntityCommand : public QUndoCommand {
+public:
+  EntityCommand(EntityPointer e, bool add)
+    : QUndoCommand(add ? "Add Entity" : "Delete Entity"), entity(e), adding(add), skip(add) {}
+
+  void undo() { adding ? entity->destroy() : entity->restore(); }
+  void redo() {
+    if(skip) {
+      skip = false;
+      return;
+    }
+    adding ? entity->restore() : entity->destroy();
+  }
+
+private:
+  EntityPointer entity;
+  bool adding, skip;
+};
+
+class EntityMoveCommand : public QUndoCommand {
+public:
+  EntityMoveCommand(EntityPointer e, QPointF p1, QRect b1, QPointF p2, QRect b2)
+    : QUndoCommand("Move Entity"), entity(e), oldPos(p1), newPos(p2),
+      oldBox(b1), newBox(b2), skip(true) {}
+
+  void undo() { set(oldPos, oldBox); }
+  void redo() {
+    if(skip) {
+      skip = false;
+      return;
+    }
+    set(newPos, newBox);
+  }
+
+private:
+  void set(QPointF p, QRect b) {
+    entity->setPos(p.x(), p.y());
+    entity->setBoundingBox(b.left(), b.top(), b.right(), b.bottom());
+  }
+
+  EntityPointer entity;
+  QPointF oldPos, newPos;
+  QRect oldBox, newBox;
+  bool skip;
+};
+
+QUndoStack * MapUndo::getStack() {
+  if(!stack) {
+    stack = new QUndoStack();
+    stack->setUndoLimit(UndoLimit);
+  }
+  return stack;
+}
+
+// Drops the history and anything still being recorded.
+void MapUndo::clear() {
+  if(pendingDiff) {
+    pendingLayer->recorder = 0;
+    delete pendingDiff;
+    pendingDiff = 0;
+    pendingLayer = 0;
+    pendingMap = 0;
+  }
+  pendingEntity = EntityPointer();
+  if(stack) stack->clear();
+  stackMap = 0;
+}
+
+// Commands point at their map, so its history goes when the map does.
+// Deleting any other map leaves the history alone.
+void MapUndo::forget(Map * map) {
+  if(map == stackMap || map == pendingMap) clear();
+}
+
+void MapUndo::push(Map * map, QUndoCommand * command) {
+  stackMap = map;
+  getStack()->push(command);
+}
+
+bool MapUndo::canUndo() {
+  QUndoStack * s = getStack();
+  const TileEditCommand * c = dynamic_cast < const TileEditCommand * > (s->command(s->index() - 1));
+  return s->canUndo() && !(c && c->isExpired());
+}
+
+void MapUndo::undo() {
+  if(canUndo()) getStack()->undo();
+}
+
+// QUndoStack only drops commands by count, so past the budget the oldest
+// tile edits free their diffs instead.  The newest one is always kept.
+void MapUndo::trim() {
+  QList < TileEditCommand * > & commands = TileEditCommand::commands;
+  for(int i = 0; i < commands.size() - 1 && TileEditCommand::totalBytes > ByteBudget; i++) {
+    commands[i]->expire();
+  }
+}
+
+void MapUndo::beginTiles(Map * map, Map::Layer * layer, QString text) {
+  endTiles();
+  if(!map || !layer) return;
+
+  pendingMap = map;
+  pendingLayer = layer;
+  pendingDiff = new TileDiff();
+  pendingText = text;
+  layer->recorder = pendingDiff;
+}
+
+void MapUndo::endTiles() {
+  if(!pendingDiff) return;
+
+  pendingLayer->recorder = 0;
+  pendingDiff->finish(pendingLayer);
+  if(pendingDiff->isEmpty())
+    delete pendingDiff;
+  else {
+    push(pendingMap, new TileEditCommand(pendingMap, pendingLayer, pendingDiff, pendingText));
+    trim();
+  }
+
+  pendingDiff = 0;
+  pendingLayer = 0;
+  pendingMap = 0;
+}
+
+bool MapUndo::isRecording() {
+  return pendingDiff != 0;
+}
+
+void MapUndo::insertLayer(Map * map, int before, int w, int h, bool wrap, int fill, QString name) {
+  endTiles();
+  Map::Layer * l = map->takeLayer(map->addLayer(w, h, wrap, fill, name));
+  push(map, new LayerCommand(map, qBound(0, before, map->getLayerCount()), l, true));
+}
+
+void MapUndo::deleteLayer(Map * map, int layer) {
+  endTiles();
+  Map::Layer * l = map->getLayer(layer);
+  if(l) push(map, new LayerCommand(map, layer, l, false));
+}
+
+void MapUndo::moveLayer(Map * map, int from, int to) {
+  endTiles();
+  if(from != to) push(map, new LayerMoveCommand(map, from, to));
+}
+
+// Call after the entity was added to its map.
+void MapUndo::addEntity(EntityPointer e) {
+  push(e->getMap(), new EntityCommand(e, true));
+}
+
+void MapUndo::deleteEntity(EntityPointer e) {
+  push(e->getMap(), new EntityCommand(e, false));
+}
+
+static QRect storedBox(EntityPointer e) {
+  int x1, y1, x2, y2;
+  e->getStoredBoundingBox(x1, y1, x2, y2);
+  return QRect(QPoint(x1, y1), QPoint(x2, y2));
+}
+
+void MapUndo::beginEntityEdit(EntityPointer e) {
+  endEntityEdit();
+  if(!e) return;
+
+  pendingEntity = e;
+  pendingPos = QPointF(e->getX(), e->getY());
+  pendingBox = storedBox(e);
+}
+
+void MapUndo::endEntityEdit() {
+  if(!pendingEntity) return;
+
+  QPointF pos(pendingEntity->getX(), pendingEntity->getY());
+  QRect box = storedBox(pendingEntity);
+  if(pos != pendingPos || box != pendingBox)
+    push(pendingEntity->getMap(), new EntityMoveCommand(pendingEntity, pendingPos, pendingBox, pos, box));
+  pendingEntity = EntityPointer();
+}
@@ -0,0 +1,83 @@
+#ifndef MAPUNDO_H
+#define MAPUNDO_H 1
+
+#include <QtGui>
+#include "map.h"
+#include "entity.h"
+
+/* The changed cells of one layer, kept as horizontal runs.  The old and new
+   values of each run are run-length encoded as (value, count) pairs, so a
+   fill costs a few ints per scanline however large it is.  capture() is
+   called before each write; finish() then reads the new values. */
+
+class TileDiff {
+public:
+  TileDiff();
+  void capture(Map::Layer * l, int x, int y, int n);
+  void finish(Map::Layer * l);
+  void apply(Map::Layer * l, bool undo) const;
+  bool isEmpty() const;
+  qint64 memoryUsage() const;
+
+private:
+  struct Run {
+    int x, y, length;
+    QVector < int > before;
+    QVector < int > after;
+  };
+
+  static void encode(Map::Layer * l, int x, int y, int n, QVector < int > & out);
+  static void decode(Map::Layer * l, int x, int y, const QVector < int > & values);
+
+  QVector < Run > runs;
+  QRect bounds;
+};
+
+/* Builds editor undo commands and pushes them on the shared undo stack.
+   Tile edits are recorded between beginTiles() and endTiles(); the layer
+   reports every write to the pending TileDiff while recording.  The stack
+   keeps at most UndoLimit commands, and tile edits past ByteBudget give up
+   their diffs oldest first; undo() stops at the first one that did. */
+
+class MapUndo {
+public:
+  enum { UndoLimit = 100, ByteBudget = 32 << 20 };
+
+  static QUndoStack * getStack();
+  static void clear();
+  static void forget(Map * map);
+  static bool canUndo();
+  static void undo();
+
+  static void beginTiles(Map * map, Map::Layer * layer, QString text);
+  static void endTiles();
+  static bool isRecording();
+
+  static void insertLayer(Map * map, int before, int w, int h, bool wrap, int fill, QString name);
+  static void deleteLayer(Map * map, int layer);
+  static void moveLayer(Map * map, int from, int to);
+
+  static void addEntity(EntityPointer e);
+  static void deleteEntity(EntityPointer e);
+  static void beginEntityEdit(EntityPointer e);
+  static void endEntityEdit();
+
+private:
+  static void trim();
+  static void push(Map * map, QUndoCommand * command);
+
+  static QUndoStack * stack;
+  // The map the commands on the stack belong to.
+  static Map * stackMap;
+
+  static Map * pendingMap;
+  static Map::Layer * pendingLayer;
+  static TileDiff * pendingDiff;
+  static QString pendingText;
+
+  static EntityPointer pendingEntity;
+  static QPointF pendingPos;
+  static QRect pendingBox;
+};
+
+#endif
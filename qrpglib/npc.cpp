@@ -91,7 +91,7 @@ void Npc::update() {
       cprint("Evaluating script: " + currentMove->script);
       QScriptContext * context = scriptEngine->pushContext();
       context->setThisObject(scriptObject);
-      scriptEngine->evaluate(currentMove->script);
+      scriptEngine->evaluate(currentMove->program);
       if(scriptEngine->hasUncaughtException()) 
         message(scriptEngine->uncaughtException().toString());
       scriptEngine->popContext();
@@ -105,7 +105,7 @@ void Npc::update() {
     } else if(currentMove->type == WaitConditionItem) {
       QScriptContext * context = scriptEngine->pushContext();
       context->setThisObject(scriptObject);
-      QScriptValue condition = scriptEngine->evaluate(currentMove->script);
+      QScriptValue condition = scriptEngine->evaluate(currentMove->program);
       if(scriptEngine->hasUncaughtException())
         message(scriptEngine->uncaughtException().toString());
       scriptEngine->popContext();
@@ -183,6 +183,7 @@ Npc::MoveQueueItem::MoveQueueItem(QString s, bool waitForCondition) {
     type = WaitConditionItem;
   }
   script = s;
+  program = QScriptProgram(s);
 }
 
 Npc::MoveQueueItem::MoveQueueItem(const MoveQueueItem & n) {
@@ -192,6 +193,7 @@ Npc::MoveQueueItem::MoveQueueItem(const MoveQueueItem & n) {
   dy = n.dy;
   speed = n.speed;
   script = n.script;
+  program = n.program;
   wait = n.wait;
   started = n.started;
 }
@@ -47,6 +47,7 @@ protected:
     int wait;
     bool condition;
     QString script;
+    QScriptProgram program;
     QScriptValue function;
   };
 
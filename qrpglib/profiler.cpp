@@ -0,0 +1,145 @@
+#include <QtCore>
+#include "profiler.h"
+#include "trace.h"
+
+bool Profiler::enabled = false;
+bool Profiler::overlay = false;
+bool Profiler::tracing = false;
+QElapsedTimer Profiler::clock;
+qint64 Profiler::lastFrame = -1;
+qint64 Profiler::current[Profiler::PhaseCount];
+qint64 Profiler::started[Profiler::PhaseCount];
+QVector < qint64 > Profiler::history[Profiler::PhaseCount];
+int Profiler::frames = 0;
+QString Profiler::cachedOverlay;
+
+const char * Profiler::names[Profiler::PhaseCount] = {
+  "frame", "step", "global scripts", "map update", "entity scripts",
+  "collision", "paint", "map draw", "overlay"
+};
+
+// Trace event categories.
+const char * Profiler::categories[Profiler::PhaseCount] = {
+  "frame", "step", "script", "update", "script",
+  "collision", "draw", "draw", "qml"
+};
+
+void Profiler::setEnabled(bool on) {
+  if(on == enabled) return;
+  enabled = on;
+  if(on) {
+    startClock();
+    reset();
+  }
+}
+
+void Profiler::startClock() {
+  if(!clock.isValid()) clock.start();
+}
+
+// The overlay needs the numbers, so showing it turns profiling on.
+void Profiler::setOverlay(bool on) {
+  overlay = on;
+  if(on) setEnabled(true);
+}
+
+void Profiler::record(int phase, qint64 start, qint64 end, const QString & args) {
+  if(enabled) current[phase] += end - start;
+  if(tracing) Trace::slice(names[phase], categories[phase], start, end, args);
+}
+
+void Profiler::begin(int phase) {
+  started[phase] = isActive() ? now() : -1;
+}
+
+void Profiler::end(int phase) {
+  if(started[phase] >= 0) record(phase, started[phase], now());
+  started[phase] = -1;
+}
+
+void Profiler::endFrame() {
+  if(!isActive()) return;
+
+  qint64 t = now();
+  // The first call only marks where the first frame starts.
+  if(lastFrame >= 0) {
+    if(tracing) Trace::slice(names[Frame], categories[Frame], lastFrame, t);
+    if(enabled) {
+      current[Frame] = t - lastFrame;
+      int slot = frames % Window;
+      for(int i = 0; i < PhaseCount; i++) {
+        history[i][slot] = current[i];
+      }
+      frames++;
+    }
+  }
+  lastFrame = t;
+
+  for(int i = 0; i < PhaseCount; i++) current[i] = 0;
+  Trace::frameEnded(t);
+}
+
+void Profiler::reset() {
+  for(int i = 0; i < PhaseCount; i++) {
+    current[i] = 0;
+    started[i] = -1;
+    history[i].fill(0, Window);
+  }
+  frames = 0;
+  lastFrame = -1;
+  cachedOverlay = QString();
+}
+
+// In milliseconds, over the frames currently in the window.
+Profiler::Stats Profiler::stats(int phase) {
+  Stats s;
+  s.min = s.avg = s.p99 = 0;
+
+  int n = qMin(frames, (int) Window);
+  if(n == 0) return s;
+
+  QVector < qint64 > v = history[phase].mid(0, n);
+  qSort(v);
+
+  qint64 total = 0;
+  for(int i = 0; i < n; i++) total += v[i];
+
+  int p = qBound(0, qCeil(n * 0.99) - 1, n - 1);
+  s.min = v[0] / 1e6;
+  s.avg = total / 1e6 / n;
+  s.p99 = v[p] / 1e6;
+  return s;
+}
+
+QString Profiler::report() {
+  if(!enabled) return "Profiling is off.";
+
+  int n = qMin(frames, (int) Window);
+  QString out = QString("%1 frame(s), ms      min      avg      p99\n").arg(n, 5);
+  for(int i = 0; i < PhaseCount; i++) {
+    Stats s = stats(i);
+    out += QString("%1 %2 %3 %4\n")
+      .arg(names[i], -20)
+      .arg(s.min, 8, 'f', 2)
+      .arg(s.avg, 8, 'f', 2)
+      .arg(s.p99, 8, 'f', 2);
+  }
+  return out;
+}
+
+// Shorter than report(), and only recomputed every OverlayRefresh frames.
+QString Profiler::overlayText() {
+  if(cachedOverlay.isEmpty() || frames % OverlayRefresh == 0) {
+    Stats frame = stats(Frame);
+    QString out = QString("%1 fps").arg(frame.avg > 0 ? 1000 / frame.avg : 0, 0, 'f', 1);
+    for(int i = 0; i < PhaseCount; i++) {
+      Stats s = stats(i);
+      out += QString("\n%1 %2 / %3")
+        .arg(names[i])
+        .arg(s.avg, 0, 'f', 2)
+        .arg(s.p99, 0, 'f', 2);
+    }
+    cachedOverlay = out;
+  }
+  return cachedOverlay;
+}
@@ -0,0 +1,92 @@
+#ifndef PROFILER_H
+#define PROFILER_H 1
+
+#include <QtCore>
+
+/* Times the phases of a frame.  Time spent in each phase is summed over a
+   frame (the span between two paints, including any simulation steps run
+   in it) and filed into a rolling window that min/avg/p99 are computed
+   from.  Phases nest, so MapUpdate includes EntityScripts, which in turn
+   includes the Collision tests the scripts cause.
+
+   While a Trace is recording, every timed phase is also recorded as a
+   slice, whether or not the profiler itself is enabled.
+
+   Everything is off by default; an inactive ProfileScope costs one branch. */
+
+class Profiler {
+public:
+  enum Phase {
+    Frame,          // time between paints
+    Step,           // simulation steps run in the frame
+    GlobalScripts,
+    MapUpdate,
+    EntityScripts,
+    Collision,
+    Paint,          // drawBackground through drawForeground
+    MapDraw,
+    Overlay,        // QML and widget items painted over the map
+    PhaseCount
+  };
+
+  static void setEnabled(bool on);
+  static bool isEnabled() { return enabled; }
+  static void setOverlay(bool on);
+  static bool hasOverlay() { return overlay; }
+  // Set by Trace while it records.
+  static void setTracing(bool on) { tracing = on; }
+  static bool isActive() { return enabled || tracing; }
+
+  // Monotonic, in nanoseconds.
+  static void startClock();
+  static qint64 now() { return clock.nsecsElapsed(); }
+  static void record(int phase, qint64 start, qint64 end, const QString & args = QString());
+
+  // For spans that don't fit in one C++ scope.
+  static void begin(int phase);
+  static void end(int phase);
+
+  // Called at the top of MapScene::drawBackground.
+  static void endFrame();
+  static void reset();
+
+  static QString report();
+  static QString overlayText();
+
+private:
+  struct Stats {
+    double min, avg, p99;
+  };
+  static Stats stats(int phase);
+
+  enum { Window = 240, OverlayRefresh = 30 };
+
+  static bool enabled;
+  static bool overlay;
+  static bool tracing;
+  static QElapsedTimer clock;
+  static qint64 lastFrame;
+  static qint64 current[PhaseCount];
+  static qint64 started[PhaseCount];
+  // Rings of per-frame totals; frames % Window is the next slot.
+  static QVector < qint64 > history[PhaseCount];
+  static int frames;
+  static QString cachedOverlay;
+  static const char * names[PhaseCount];
+  static const char * categories[PhaseCount];
+};
+
+class ProfileScope {
+public:
+  ProfileScope(int p) : phase(p), start(Profiler::isActive() ? Profiler::now() : -1) {}
+  ~ProfileScope() { if(start >= 0) Profiler::record(phase, start, Profiler::now(), args); }
+  // Only shows up in traces; check Trace::isRecording() before building it.
+  void setArgs(const QString & a) { args = a; }
+
+private:
+  int phase;
+  qint64 start;
+  QString args;
+};
+
+#endif
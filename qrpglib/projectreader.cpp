@@ -5,6 +5,8 @@
 #include "project.h"
 #include "rpgengine.h"
 #include "globals.h"
+#include "textureatlas.h"
+#include <QtConcurrentMap>
 
 void ProjectReader::tokenDebug()
 {
@@ -101,36 +103,98 @@ void ProjectReader::readProject()
     }
   }
 
+  // Tilesets, sprites and maps only depend on each other through the name
+  // registries, so read them all on the thread pool at once: tilesets are
+  // parsed and decoded, sprites parsed and maps only peeked at for their
+  // names.  Registration below stays serial and in order.
+  QElapsedTimer loadTime;
+  loadTime.start();
+
+  QStringList tilesetPaths = absolutePaths("tilesets", tilesetlist);
+  QFuture < QSharedPointer < BitmapReader > > tilesets =
+    QtConcurrent::mapped(tilesetPaths, parseTileset);
+  QStringList spritePaths = absolutePaths("sprites", spritelist);
+  QFuture < QSharedPointer < SpriteReader > > sprites =
+    QtConcurrent::mapped(spritePaths, parseSprite);
+  QStringList mapPaths = absolutePaths("maps", maplist);
+  QFuture < QSharedPointer < MapReader > > mapReaders =
+    QtConcurrent::mapped(mapPaths, peekMap);
+  tilesetlist.clear();
+  spritelist.clear();
+  maplist.clear();
+
   // Load bitmaps
   dirExists = QDir::setCurrent("tilesets");
-  BitmapReader bitmapReader;
-  while(!tilesetlist.isEmpty()) {
-    QString b = tilesetlist.takeFirst();
-    // load bitmap
-    bitmapReader.read(b);
+  for(int i = 0; i < tilesetPaths.size(); i++) {
+    // resultAt() waits for just this one, later files keep decoding meanwhile.
+    tilesets.resultAt(i)->create();
   }
+  TextureAtlas::build();
   if(dirExists) QDir::setCurrent("..");
 
   // load sprites
   dirExists = QDir::setCurrent("sprites");
-  SpriteReader spriteReader;
-  while(!spritelist.isEmpty()) {
-    QString s = spritelist.takeFirst();
-    // load sprite
-    spriteReader.read(s);
+  for(int i = 0; i < spritePaths.size(); i++) {
+    sprites.resultAt(i)->create();
   }
   if(dirExists) QDir::setCurrent("..");
 
-  // load maps
+  // Maps are only registered here; MapCache loads them when first shown.
   dirExists = QDir::setCurrent("maps");
-  MapReader mapReader;
-  while(!maplist.isEmpty()) {
-    QString m = maplist.takeFirst();
-    // load map
-    mapReader.read(m);
+  mapFiles.clear();
+  for(int i = 0; i < mapPaths.size(); i++) {
+    QSharedPointer < MapReader > mapReader = mapReaders.resultAt(i);
+    Map * map = mapReader->createStub();
+
+    if(!map) {
+      // Parse it fully so the error gets reported.
+      mapReader->parse(mapPaths[i]);
+      map = mapReader->create();
+    }
+    if(map)
+      mapFiles.append(qMakePair(map, mapPaths[i]));
   }
   if(dirExists) QDir::setCurrent("..");
 
+  cprint("Project loaded in " + QString::number(loadTime.elapsed()) + " ms");
+}
+
+QStringList ProjectReader::absolutePaths(QString dir, QList < QString > files)
+{
+  // Same lookup as QDir::setCurrent(dir) followed by relative opens.
+  QDir d = QDir::current();
+  d.cd(dir);
+
+  QStringList paths;
+  for(int i = 0; i < files.size(); i++)
+    paths.append(d.absoluteFilePath(files[i]));
+  return paths;
+}
+
+QSharedPointer < BitmapReader > ProjectReader::parseTileset(const QString & filename)
+{
+  QSharedPointer < BitmapReader > reader(new BitmapReader);
+  reader->parse(filename);
+  return reader;
+}
+
+QSharedPointer < SpriteReader > ProjectReader::parseSprite(const QString & filename)
+{
+  QSharedPointer < SpriteReader > reader(new SpriteReader);
+  reader->parse(filename);
+  return reader;
+}
+
+QSharedPointer < MapReader > ProjectReader::peekMap(const QString & filename)
+{
+  QSharedPointer < MapReader > reader(new MapReader);
+  reader->peek(filename);
+  return reader;
+}
+
+QList < QPair < Map *, QString > > ProjectReader::getMapFiles()
+{
+  return mapFiles;
 }
 
 void ProjectReader::readMaps()
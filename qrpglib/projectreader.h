@@ -4,12 +4,19 @@
 #include <QtCore>
 
 class Project;
+class Map;
+class BitmapReader;
+class SpriteReader;
+class MapReader;
 
 class ProjectReader : public QXmlStreamReader {
 public:
   Project * read(QIODevice * device);
   Project * read(QString filename);
 
+  // Every map loaded by the last read() with the absolute path of its .xmap.
+  QList < QPair < Map *, QString > > getMapFiles();
+
 private:
   void readProject();
   void readMaps();
@@ -19,10 +26,17 @@ private:
   void readUnknownElement();
   void tokenDebug();
 
+  // Run on the thread pool by readProject().
+  static QSharedPointer < BitmapReader > parseTileset(const QString & filename);
+  static QSharedPointer < SpriteReader > parseSprite(const QString & filename);
+  static QSharedPointer < MapReader > peekMap(const QString & filename);
+  static QStringList absolutePaths(QString dir, QList < QString > files);
+
   Project * project;
   QList < QString > maplist;
   QList < QString > spritelist;
   QList < QString > tilesetlist;
+  QList < QPair < Map *, QString > > mapFiles;
   QFileInfo fileinfo;
 };
 
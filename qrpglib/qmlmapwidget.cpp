@@ -24,6 +24,8 @@
 #include "rpgengine.h"
 #include "rpgscript.h"
 #include "mapscene.h"
+#include "mapcache.h"
+#include "textureresidency.h"
 
 using std::cout;
 
@@ -189,6 +191,8 @@ void QmlMapWidget::setMap(int map_num) {
   RPGEngine::setCurrentMap(0);
   if(map_num >= 0) {
     map = maps[map_num];
+    MapCache::use(map);
+    TextureResidency::prefetch(map);
   }
   layer = 0;
   w = width();
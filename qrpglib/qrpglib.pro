@@ -59,7 +59,23 @@ SOURCES += \
     mapscene.cpp \
     coordinatewidget.cpp \
     boundswidget.cpp \
-    entityscript.cpp
+    entityscript.cpp \
+    tilebatch.cpp \
+    textureatlas.cpp \
+    gameloop.cpp \
+    entitygrid.cpp \
+    triggerindex.cpp \
+    tiledataparser.cpp \
+    binarymap.cpp \
+    mapcache.cpp \
+    mappreloader.cpp \
+    textureresidency.cpp \
+    tileops.cpp \
+    sparsetiles.cpp \
+    mapundo.cpp \
+    profiler.cpp \
+    trace.cpp \
+    benchmark.cpp
 
 HEADERS +=\
     tileselect.h \
@@ -109,4 +125,20 @@ HEADERS +=\
     mapscene.h \
     coordinatewidget.h \
     boundswidget.h \
-    entityscript.h
+    entityscript.h \
+    tilebatch.h \
+    textureatlas.h \
+    gameloop.h \
+    entitygrid.h \
+    triggerindex.h \
+    tiledataparser.h \
+    binarymap.h \
+    mapcache.h \
+    mappreloader.h \
+    textureresidency.h \
+    tileops.h \
+    sparsetiles.h \
+    mapundo.h \
+    profiler.h \
+    trace.h \
+    benchmark.h
@@ -5,9 +5,19 @@
 #include "globals.h"
 #include "map.h"
 #include "player.h"
+#include "rpgscript.h"
+#include "input.h"
+#include "mapbox.h"
+#include "mapcache.h"
+#include "mappreloader.h"
+#include "scriptutils.h"
+#include "profiler.h"
+#include "trace.h"
 #include "SDL/SDL.h"
 #include "SDL/SDL_mixer.h"
 
+bool RPGEngine::audio = false;
+
 void RPGEngine::init() {
   int audio_rate = 44100;
   Uint16 audio_format = AUDIO_S16;
@@ -15,11 +25,76 @@ void RPGEngine::init() {
   int audio_buffers = 4096;
   rpgEngineStarting = true;
 
+  // Without a sound device the game still runs, just silently.
+  audio = false;
+  if(headless) return;
   SDL_Init(SDL_INIT_AUDIO);
   if(Mix_OpenAudio(audio_rate, audio_format, audio_channels, audio_buffers)) {
     printf("Mix_OpenAudio: %s\n", Mix_GetError());
-    exit(1);
+    return;
+  }
+  audio = true;
+}
+
+bool RPGEngine::hasAudio() {
+  return audio;
+}
+
+// One fixed-rate simulation step: global scripts, then the current map and
+// its entities.  MapScene::step adds the window's own keys on top.
+void RPGEngine::step() {
+  MapPreloader::step();
+
+  if(input->action) playerEntity->setActivated(true);
+
+  Profiler::begin(Profiler::GlobalScripts);
+  if(rpgEngineStarting) {
+    scriptUtils->include("scripts/startup.js");
+  }
+
+  // Global scripts.
+  for(int i = 0; i < globalScripts.size(); i++) {
+    bool execute = false;
+    RPGScript * s = &(globalScripts[i]);
+    if(rpgEngineStarting && s->condition == ScriptCondition::Load) {
+      execute = true;
+    } else if(s->condition == ScriptCondition::EveryFrame) {
+      execute = true;
+    }
+
+    if(execute) {
+      TraceScope trace("global script", "script");
+      if(Trace::isRecording()) trace.setArgs(Trace::args("index", QString::number(i)));
+      s->run();
+    }
+  }
+  Profiler::end(Profiler::GlobalScripts);
+
+  rpgEngineStarting = false;
+
+  if(currentMap) currentMap->update();
+
+  playerEntity->setActivated(false);
+  input->action = false;
+}
+
+// Headless there is no MapBox, so only the engine's side of switching maps
+// is done here.
+void RPGEngine::setMap(int map_num) {
+  if(mapBox) {
+    mapBox->setMap(map_num);
+    return;
+  }
+
+  if(currentMap)
+    currentMap->runUnLoadScripts();
+
+  Map * map = map_num >= 0 ? maps[map_num] : 0;
+  if(map) {
+    MapCache::use(map);
+    map->setStarting(true);
   }
+  setCurrentMap(map);
 }
 
 void RPGEngine::setCurrentMap(Map * m) {
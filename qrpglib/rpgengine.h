@@ -10,6 +10,9 @@ class RPGEngine
 {
 public:
   static void init();
+  static bool hasAudio();
+  static void step();
+  static void setMap(int);
   static void setCurrentMap(Map *);
   static void setPlayerEntity(Player *);
   static Map * getCurrentMap();
@@ -22,6 +25,9 @@ public:
   static int getScriptCondition(int);
   static void dumpEvent(QEvent *);
   static QString eventName(QEvent *);
+
+private:
+  static bool audio;
 };
 
 #endif // RPGENGINE_H
@@ -4,9 +4,37 @@
 
 RPGScript::RPGScript(int c, QString s) {
   condition = c;
-  script = s;
+  setScript(s);
 };
 
+void RPGScript::setScript(QString s) {
+  script = s;
+  program = QScriptProgram(s);
+}
+
+// Runs the script in the global context.
+QScriptValue RPGScript::run() {
+  QScriptValue r = scriptEngine->evaluate(program);
+
+  if(scriptEngine->hasUncaughtException())
+    message(scriptEngine->uncaughtException().toString());
+
+  return r;
+}
+
+// Runs the script in a new context with "this" set to thisObject.
+QScriptValue RPGScript::run(QScriptValue thisObject) {
+  QScriptContext * context = scriptEngine->pushContext();
+  context->setThisObject(thisObject);
+  QScriptValue r = scriptEngine->evaluate(program);
+
+  if(scriptEngine->hasUncaughtException())
+    message(scriptEngine->uncaughtException().toString());
+
+  scriptEngine->popContext();
+  return r;
+}
+
 QString RPGScript::toXml(int indent) {
   QString output;
 
@@ -2,14 +2,22 @@
 #define RPGSCRIPT_H
 
 #include <QtCore>
+#include <QtScript>
 
 class RPGScript
 {
 public:
     RPGScript(int c, QString s);
     QString toXml(int indent = 0);
+    void setScript(QString s);
+    QScriptValue run();
+    QScriptValue run(QScriptValue thisObject);
     int condition;
     QString script;
+
+private:
+    // Compiled form of script; the engine parses it once and reuses it.
+    QScriptProgram program;
 };
 
 #endif // RPGSCRIPT_H
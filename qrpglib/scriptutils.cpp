@@ -10,6 +10,17 @@
 #include "mapscene.h"
 #include "mapbox.h"
 #include "sound.h"
+#include "tilebatch.h"
+#include "textureatlas.h"
+#include "gameloop.h"
+#include "collisiontester.h"
+#include "benchmark.h"
+#include "mapcache.h"
+#include "mappreloader.h"
+#include "textureresidency.h"
+#include "profiler.h"
+#include "trace.h"
+#include "rpgengine.h"
 
 QScriptValue bindObjectConstructor(QScriptContext * context, QScriptEngine * engine);
 
@@ -77,6 +88,7 @@ void ScriptUtils::init() {
   qScriptRegisterMetaType(scriptEngine, entityPointerToScriptValue, entityPointerFromScriptValue);
 
   scriptEngine->globalObject().setProperty("global", scriptEngine->globalObject());
+  if(!mapBox) return;
   scriptEngine->globalObject().setProperty("mapBox", scriptEngine->newQObject(mapBox));
   scriptEngine->globalObject().setProperty("mapScene", scriptEngine->newQObject(mapBox->mapScene));
 
@@ -110,8 +122,21 @@ QScriptValue ScriptUtils::getEntity(QString s) {
   return e->getScriptObject();
 }
 
+// Switches to the map once it has been preloaded, then puts the player at
+// x, y.  Returns false if there is no such map.
 QScriptValue ScriptUtils::teleport(QString map, int x, int y) {
-  return QScriptValue(QScriptValue::NullValue);
+  if(!mapnames.contains(map)) {
+    cprint("No map named " + map);
+    return QScriptValue(false);
+  }
+  MapPreloader::teleport(maps[mapnames[map]], x, y);
+  return QScriptValue(true);
+}
+
+bool ScriptUtils::preloadMap(QString map) {
+  if(!mapnames.contains(map)) return false;
+  MapPreloader::preload(maps[mapnames[map]]);
+  return true;
 }
 
 QScriptValue ScriptUtils::copy(QScriptValue v) {
@@ -130,17 +155,17 @@ QScriptValue ScriptUtils::copy(QScriptValue v) {
 
 void ScriptUtils::setCamera(EntityPointer e) {
   cprint("Setting camera");
-  mapBox->setCamera(e);
+  if(mapBox) mapBox->setCamera(e);
 }
 
 void ScriptUtils::setMap(QString m) {
   cprint("Setting map to " + m);
-  mapBox->setMap(mapnames[m]);
+  RPGEngine::setMap(mapnames[m]);
 }
 
 void ScriptUtils::setLayer(int l) {
   cprint("Setting layer to " + QString::number(l));
-  mapBox->setLayer(l);
+  if(mapBox) mapBox->setLayer(l);
 }
 
 bool ScriptUtils::chdir(QString dir) {
@@ -148,12 +173,17 @@ bool ScriptUtils::chdir(QString dir) {
 }
 
 void ScriptUtils::addQml(QString filename) {
+  TraceScope trace("qml component", "qml");
+  if(Trace::isRecording()) trace.setArgs(Trace::args("source", filename));
+  if(!mapBox) return;
   QDeclarativeComponent component(declarativeEngine, filename);
   QGraphicsObject * c = qobject_cast<QGraphicsObject *>(component.create());
   mapBox->mapScene->addItem(c);
 }
 
 void ScriptUtils::addQmlString(QString string) {
+  TraceScope trace("qml component", "qml");
+  if(!mapBox) return;
   QDeclarativeComponent component(declarativeEngine);
   component.setData(string.toAscii(), QUrl());
   QGraphicsObject * c = qobject_cast<QGraphicsObject *>(component.create());
@@ -187,6 +217,9 @@ QScriptValue ScriptUtils::include(QString filename) {
   QString program(in.readAll());
   f.close();
 
+  TraceScope trace("include", "script");
+  if(Trace::isRecording()) trace.setArgs(Trace::args("source", filename));
+
   QScriptContext *context = scriptEngine->currentContext();
   QScriptContext *parent = context->parentContext();
   if(parent!=0)
@@ -267,6 +300,10 @@ QScriptValue ScriptUtils::loadJSON(QString filename) {
 // Ideally, the components should be loaded at start time instad of when created.
 // This is mostly just to make sure it works.
 QScriptValue ScriptUtils::createComponent(QString filename) {
+  TraceScope trace("qml component", "qml");
+  if(Trace::isRecording()) trace.setArgs(Trace::args("source", filename));
+  // There's no scene to show components in headless.
+  if(!mapBox) return QScriptValue(QScriptValue::NullValue);
   QDeclarativeComponent * c = new QDeclarativeComponent(mapBox->engine(), filename, mapBox->engine());
   if(c->status() == QDeclarativeComponent::Error) {
       qDebug() << "COMPONENT ERROR: " << c->errors();
@@ -286,6 +323,9 @@ QScriptValue ScriptUtils::createComponent(QString filename) {
 }
 
 QScriptValue ScriptUtils::createComponent(QString filename, QObject * parent) {
+  TraceScope trace("qml component", "qml");
+  if(Trace::isRecording()) trace.setArgs(Trace::args("source", filename));
+  if(!mapBox) return QScriptValue(QScriptValue::NullValue);
   QDeclarativeComponent * c = new QDeclarativeComponent(mapBox->engine(), filename, parent);
   if(c->status() == QDeclarativeComponent::Error) {
     qDebug() << c->errors();
@@ -323,3 +363,106 @@ QString ScriptUtils::currentDir() {
   return QDir::currentPath();
 }
 
+int ScriptUtils::getDrawCalls() {
+  return TileBatch::getDrawCalls();
+}
+
+QString ScriptUtils::atlasReport() {
+  return TextureAtlas::report();
+}
+
+void ScriptUtils::setFpsCap(int fps) {
+  if(gameLoop) gameLoop->setFpsCap(fps);
+}
+
+void ScriptUtils::setStepRate(int stepsPerSecond) {
+  if(gameLoop) gameLoop->setStepRate(stepsPerSecond);
+}
+
+void ScriptUtils::setMapBudget(int megabytes) {
+  MapCache::setBudget(megabytes);
+}
+
+QString ScriptUtils::mapCacheReport() {
+  return MapCache::report();
+}
+
+// Storage mode and size of each layer of the current map.
+QString ScriptUtils::layerReport() {
+  Map * map = RPGEngine::getCurrentMap();
+  if(!map) return QString();
+  return map->layerReport();
+}
+
+void ScriptUtils::setTextureBudget(int megabytes) {
+  TextureResidency::setBudget(megabytes);
+}
+
+QString ScriptUtils::textureReport() {
+  return TextureResidency::report();
+}
+
+// Per-phase frame times; starts profiling if it isn't running yet.
+QString ScriptUtils::profile() {
+  if(!Profiler::isEnabled()) {
+    Profiler::setEnabled(true);
+    return "Profiling started; call rpgx.profile() again for the numbers.";
+  }
+  return Profiler::report();
+}
+
+void ScriptUtils::setProfiling(bool on) {
+  Profiler::setEnabled(on);
+  if(!on) Profiler::setOverlay(false);
+}
+
+void ScriptUtils::showProfiler(bool on) {
+  Profiler::setOverlay(on);
+}
+
+// Writes a Chrome trace-event file when stopped, or after the given
+// number of seconds.
+void ScriptUtils::startTrace(int seconds, QString file) {
+  Trace::start(seconds, file);
+}
+
+bool ScriptUtils::stopTrace() {
+  return Trace::stop();
+}
+
+QString ScriptUtils::traceStatus() {
+  return Trace::status();
+}
+
+// Compares grid-based collision against a full scan on every layer of the
+// current map; returns the number of mismatches.
+int ScriptUtils::verifyBroadphase(int trials) {
+  int mismatches = 0;
+  Map * map = RPGEngine::getCurrentMap();
+  if(!map) return 0;
+
+  for(int i = 0; i < map->getLayerCount(); i++) {
+    mismatches += CollisionTester::verifyBroadphase(map, i, trials);
+  }
+  cprint(QString::number(mismatches) + " broadphase mismatch(es)");
+  return mismatches;
+}
+
+// Runs the same comparison on generated entities, so it needs no map.
+int ScriptUtils::testBroadphase(int entities, int trials) {
+  int mismatches = CollisionTester::selfTest(entities, trials);
+  cprint(QString::number(mismatches) + " broadphase mismatch(es)");
+  return mismatches;
+}
+
+QString ScriptUtils::benchmarkScripts(int npcs, int frames) {
+  return Benchmark::scripts(npcs, frames);
+}
+
+QString ScriptUtils::benchmarkMapLoad(int size, int layers) {
+  return Benchmark::mapLoad(size, layers);
+}
+
+QString ScriptUtils::benchmarkDepthSort(int entities, int frames) {
+  return Benchmark::depthSort(entities, frames);
+}
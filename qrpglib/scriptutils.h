@@ -29,6 +29,7 @@ public slots:
   void unPause();
   QScriptValue getEntity(QString s);
   QScriptValue teleport(QString, int, int);
+  bool preloadMap(QString map);
   QScriptValue createComponent(QString filename);
   QScriptValue createComponent(QString filename, QObject * parent);
   QScriptValue copy(QScriptValue v);
@@ -45,6 +46,26 @@ public slots:
   QScriptValue include(QString filename);
   void dumpScriptObject(QScriptValue objectValue);
   bool same(QObject * a, QObject * b);
+  int getDrawCalls();
+  QString atlasReport();
+  void setFpsCap(int fps);
+  void setStepRate(int stepsPerSecond);
+  int verifyBroadphase(int trials = 1000);
+  int testBroadphase(int entities = 500, int trials = 1000);
+  QString benchmarkScripts(int npcs = 500, int frames = 60);
+  QString benchmarkMapLoad(int size = 1024, int layers = 4);
+  QString benchmarkDepthSort(int entities = 2000, int frames = 600);
+  void setMapBudget(int megabytes);
+  QString mapCacheReport();
+  QString layerReport();
+  void setTextureBudget(int megabytes);
+  QString textureReport();
+  QString profile();
+  void setProfiling(bool on);
+  void showProfiler(bool on);
+  void startTrace(int seconds = 0, QString file = QString());
+  bool stopTrace();
+  QString traceStatus();
 
 signals:
   void menuKey();
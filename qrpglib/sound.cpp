@@ -4,6 +4,7 @@
 #include "SDL/SDL_mixer.h"
 #include "sound.h"
 #include "globals.h"
+#include "rpgengine.h"
 
 Sound::Sound(QObject *parent) :
     QObject(parent)
@@ -39,7 +40,7 @@ void Sound::play()
 void Sound::stop()
 {
   cprint("Stopping sound '" + name + "'");
-  Mix_HaltChannel(channel);
+  if(RPGEngine::hasAudio()) Mix_HaltChannel(channel);
   playing = false;
 }
 
@@ -62,6 +63,9 @@ void Sound::load(QString filename)
   qDebug() << "Loading sound '" + filename + "'";
   name = filename;
   if(chunk) Mix_FreeChunk(chunk);
+  chunk = 0;
+  // Without audio every sound stays empty and play() does nothing.
+  if(!RPGEngine::hasAudio()) return;
   chunk = Mix_LoadWAV(filename.toAscii());
   if(!chunk) {
     qDebug() << QString(sprintf("Mix_LoadWAV: %s\n", Mix_GetError()));
@@ -0,0 +1,233 @@
+#include <string.h>
+#include "sparsetiles.h"
+
+// The chunk helpers are shared between the 16 and 32-bit tables.
+template < class T >
+static void fillChunks(QVector < QVector < T > > & chunks, const int * data,
+                       int w, int h, int chunks_w) {
+  const int size = SparseTiles::ChunkSize;
+  for(int c = 0; c < chunks.size(); c++) {
+    int x1 = (c % chunks_w) * size;
+    int y1 = (c / chunks_w) * size;
+    int x2 = qMin(x1 + size, w);
+    int y2 = qMin(y1 + size, h);
+
+    bool empty = true;
+    for(int y = y1; y < y2 && empty; y++) {
+      for(int x = x1; x < x2; x++) {
+        if(data[x + y * w]) {
+          empty = false;
+          break;
+        }
+      }
+    }
+    if(empty) continue;
+
+    QVector < T > chunk(size * size, 0);
+    for(int y = y1; y < y2; y++) {
+      for(int x = x1; x < x2; x++) {
+        chunk[(x - x1) + (y - y1) * size] = data[x + y * w];
+      }
+    }
+    chunks[c] = chunk;
+  }
+}
+
+template < class T >
+static void expandChunks(const QVector < QVector < T > > & chunks, int * dst,
+                         int w, int h, int chunks_w) {
+  const int size = SparseTiles::ChunkSize;
+  memset(dst, 0, w * h * sizeof(int));
+  for(int c = 0; c < chunks.size(); c++) {
+    if(chunks[c].isEmpty()) continue;
+    const T * chunk = chunks[c].constData();
+    int x1 = (c % chunks_w) * size;
+    int y1 = (c / chunks_w) * size;
+    int x2 = qMin(x1 + size, w);
+    int y2 = qMin(y1 + size, h);
+
+    for(int y = y1; y < y2; y++) {
+      for(int x = x1; x < x2; x++) {
+        dst[x + y * w] = chunk[(x - x1) + (y - y1) * size];
+      }
+    }
+  }
+}
+
+template < class T >
+static int replaceInChunks(QVector < QVector < T > > & chunks, int from, int to) {
+  int changed = 0;
+  for(int c = 0; c < chunks.size(); c++) {
+    if(chunks[c].isEmpty() || !chunks[c].contains((T) from)) continue;
+    // Writing through data() unshares the chunk first.
+    T * chunk = chunks[c].data();
+    for(int i = 0; i < chunks[c].size(); i++) {
+      if(chunk[i] == (T) from) {
+        chunk[i] = (T) to;
+        changed++;
+      }
+    }
+  }
+  return changed;
+}
+
+// Drops chunks that went back to all zeros and makes identical chunks share
+// their data.  Contents are only hashed here, never on lookups.
+template < class T >
+static void compactChunks(QVector < QVector < T > > & chunks) {
+  QHash < QByteArray, int > seen;
+  for(int c = 0; c < chunks.size(); c++) {
+    if(chunks[c].isEmpty()) continue;
+    if(chunks[c].count(0) == chunks[c].size()) {
+      chunks[c] = QVector < T > ();
+      continue;
+    }
+
+    QByteArray key((const char *) chunks[c].constData(), chunks[c].size() * sizeof(T));
+    QHash < QByteArray, int >::const_iterator i = seen.find(key);
+    if(i == seen.end())
+      seen.insert(key, c);
+    else
+      chunks[c] = chunks[i.value()];
+  }
+}
+
+template < class T >
+static void countChunks(const QVector < QVector < T > > & chunks, int & allocated, int & unique) {
+  QSet < const T * > data;
+  allocated = 0;
+  for(int c = 0; c < chunks.size(); c++) {
+    if(chunks[c].isEmpty()) continue;
+    allocated++;
+    data.insert(chunks[c].constData());
+  }
+  unique = data.size();
+}
+
+SparseTiles::SparseTiles(const int * data, int w, int h) {
+  width = w;
+  height = h;
+  chunks_w = (w + ChunkSize - 1) / ChunkSize;
+  chunks_h = (h + ChunkSize - 1) / ChunkSize;
+
+  wide = false;
+  for(int i = 0; i < w * h && !wide; i++) {
+    if(data[i] < 0 || data[i] > 0xffff) wide = true;
+  }
+
+  if(wide) {
+    wideChunks.resize(chunks_w * chunks_h);
+    fillChunks(wideChunks, data, w, h, chunks_w);
+  } else {
+    narrow.resize(chunks_w * chunks_h);
+    fillChunks(narrow, data, w, h, chunks_w);
+  }
+  compact();
+}
+
+void SparseTiles::set(int x, int y, int tile) {
+  if(!wide && (tile < 0 || tile > 0xffff)) widen();
+
+  int c = x / ChunkSize + (y / ChunkSize) * chunks_w;
+  int i = x % ChunkSize + (y % ChunkSize) * ChunkSize;
+  if(wide) {
+    QVector < qint32 > & chunk = wideChunks[c];
+    if(chunk.isEmpty()) {
+      if(tile == 0) return;
+      chunk.fill(0, ChunkSize * ChunkSize);
+    }
+    chunk[i] = tile;
+  } else {
+    QVector < quint16 > & chunk = narrow[c];
+    if(chunk.isEmpty()) {
+      if(tile == 0) return;
+      chunk.fill(0, ChunkSize * ChunkSize);
+    }
+    chunk[i] = tile;
+  }
+}
+
+// Writes every tile into a dense width x height array.
+void SparseTiles::expand(int * dst) const {
+  if(wide)
+    expandChunks(wideChunks, dst, width, height, chunks_w);
+  else
+    expandChunks(narrow, dst, width, height, chunks_w);
+}
+
+// Replaces a non-zero tile id; empty chunks hold nothing to replace.
+int SparseTiles::replace(int from, int to) {
+  if(from == 0 || from == to) return 0;
+  if(!wide && (from < 0 || from > 0xffff)) return 0;
+  if(!wide && (to < 0 || to > 0xffff)) widen();
+
+  if(wide) return replaceInChunks(wideChunks, from, to);
+  return replaceInChunks(narrow, from, to);
+}
+
+void SparseTiles::compact() {
+  if(wide)
+    compactChunks(wideChunks);
+  else
+    compactChunks(narrow);
+}
+
+void SparseTiles::widen() {
+  if(wide) return;
+
+  wideChunks.resize(narrow.size());
+  for(int c = 0; c < narrow.size(); c++) {
+    if(narrow[c].isEmpty()) continue;
+    QVector < qint32 > chunk(narrow[c].size());
+    for(int i = 0; i < chunk.size(); i++) chunk[i] = narrow[c][i];
+    wideChunks[c] = chunk;
+  }
+  narrow.clear();
+  wide = true;
+  compact();
+}
+
+bool SparseTiles::isWide() const {
+  return wide;
+}
+
+int SparseTiles::chunkCount() const {
+  return chunks_w * chunks_h;
+}
+
+int SparseTiles::allocatedChunks() const {
+  int allocated, unique;
+  if(wide)
+    countChunks(wideChunks, allocated, unique);
+  else
+    countChunks(narrow, allocated, unique);
+  return allocated;
+}
+
+int SparseTiles::sharedChunks() const {
+  int allocated, unique;
+  if(wide)
+    countChunks(wideChunks, allocated, unique);
+  else
+    countChunks(narrow, allocated, unique);
+  return allocated - unique;
+}
+
+qint64 SparseTiles::memoryUsage() const {
+  int allocated, unique;
+  qint64 tileBytes;
+  if(wide) {
+    countChunks(wideChunks, allocated, unique);
+    tileBytes = sizeof(qint32);
+  } else {
+    countChunks(narrow, allocated, unique);
+    tileBytes = sizeof(quint16);
+  }
+  return sizeof(SparseTiles) + (qint64) chunkCount() * sizeof(QVector < qint32 >) +
+    (qint64) unique * ChunkSize * ChunkSize * tileBytes;
+}
+
+QString SparseTiles::report() const {
+  return QString("sparse %1-bit, %2 of %3 chunks allocated, %4 shared")
+    .arg(wide ? 32 : 16).arg(allocatedChunks()).arg(chunkCount()).arg(sharedChunks());
+}
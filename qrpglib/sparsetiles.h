@@ -0,0 +1,51 @@
+#ifndef SPARSETILES_H
+#define SPARSETILES_H 1
+
+#include <QtCore>
+
+/* Compact storage for mostly empty layers.  Tiles are kept in fixed-size
+   chunks that are only allocated once something non-zero is written, as
+   16-bit ids unless a tile needs more.  Chunks are implicitly shared
+   QVectors, so identical chunks found by compact() share one copy until
+   one of them is written to.  Lookups index the chunk table directly. */
+
+class SparseTiles {
+public:
+  enum { ChunkSize = 32 };
+
+  SparseTiles(const int * data, int w, int h);
+  int get(int x, int y) const;
+  void set(int x, int y, int tile);
+  void expand(int * dst) const;
+  int replace(int from, int to);
+  void compact();
+
+  bool isWide() const;
+  int chunkCount() const;
+  int allocatedChunks() const;
+  int sharedChunks() const;
+  qint64 memoryUsage() const;
+  QString report() const;
+
+private:
+  void widen();
+
+  int width, height;
+  int chunks_w, chunks_h;
+  bool wide;
+  QVector < QVector < quint16 > > narrow;
+  QVector < QVector < qint32 > > wideChunks;
+};
+
+inline int SparseTiles::get(int x, int y) const {
+  int c = x / ChunkSize + (y / ChunkSize) * chunks_w;
+  int i = x % ChunkSize + (y % ChunkSize) * ChunkSize;
+  if(wide) {
+    const QVector < qint32 > & chunk = wideChunks.at(c);
+    return chunk.isEmpty() ? 0 : chunk.at(i);
+  }
+  const QVector < quint16 > & chunk = narrow.at(c);
+  return chunk.isEmpty() ? 0 : chunk.at(i);
+}
+
+#endif
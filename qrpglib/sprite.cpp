@@ -137,8 +137,8 @@ void Sprite::save(QString filename) {
     for(j = 0; j < f; j++) {
       file << "    <frame>\n";
       int b, d;
-      b = states[i]->frames[j]->bitmap;
-      d = states[i]->frames[j]->duration;
+      b = states[i]->frames[j].bitmap;
+      d = states[i]->frames[j].duration;
       file << "      <bitmap>" << b << "</bitmap>\n";
       file << "      <duration>" << d << "</duration>\n";
       file << "    </frame>\n";
@@ -152,34 +152,22 @@ void Sprite::save(QString filename) {
 
 void Sprite::draw(int state, int time, int x, int y, double opacity) {
   // Don't crash on empty sprites!
-  if(bitmap == 0 || state < 0) return;
-  if(state >= states.size()) return;
-  if(states[state]->frames.size() == 0) return;
-  
-  if(states[state]->loop >= 0) {
-    time %= states[state]->max_time;
-  } else if(time > states[state]->max_time) {
-    time = states[state]->max_time;
-  }
+  if(bitmap == 0) return;
 
-  int i = 0;
-  bool done = false;
-  while(!done && i < states[state]->frames.size()) {
-    //    cout << time << " " << i << " " <<
-    //      states[state]->frames[i]->end_time << "\n";
-    if(states[state]->frames[i]->end_time >= time) {
-      bitmap->draw(states[state]->frames[i]->bitmap, x - x_origin, y - y_origin, opacity);
-      //bitmap->DrawBoundingBox(states[state]->frames[i]->bitmap, x, y);
-      //DrawBoundingBox(x, y);
-      done = true;
-    }
-    i++;
-  } 
+  int frame = getFrameAt(state, time);
+  if(frame >= 0)
+    bitmap->draw(states[state]->frames[frame].bitmap, x - x_origin, y - y_origin, opacity);
+}
+
+// Index of the frame showing "time" ms into the state's animation, or -1.
+int Sprite::getFrameAt(int state, int time) const {
+  if(state < 0 || state >= states.size()) return -1;
+  return states[state]->frameAt(time);
 }
 
 void Sprite::drawFrame(int state, int frame, int x, int y, double opacity) {
   if(bitmap && state >= 0 && frame >= 0 && states.size() > state && states[state]->frames.size() > frame) 
-    bitmap->draw(states[state]->frames[frame]->bitmap, x - x_origin, y - y_origin, opacity);
+    bitmap->draw(states[state]->frames[frame].bitmap, x - x_origin, y - y_origin, opacity);
 }
 
 void Sprite::drawBoundingBox(int x, int y) { 
@@ -223,36 +211,25 @@ void Sprite::addFrame(int state, int duration, int bitmap) {
 
 void Sprite::insertFrame(int state, int frame, int duration, int bitmap) {
   if(state < states.size()) {
-    int end_time = 0;
-    if(states[state]->frames.size())
-      end_time = states[state]->frames[states[state]->frames.size()-1]->end_time;
-    end_time += duration;
-
-    Frame * f = new Frame;
-    f->bitmap = bitmap;
-    f->end_time = end_time;
-    f->duration = duration;
+    Frame f;
+    f.bitmap = bitmap;
+    f.end_time = 0;
+    f.duration = duration;
     states[state]->frames.insert(frame, f);
-    states[state]->max_time += duration;
+    states[state]->updateTimes();
   }
 }
 
 void Sprite::delFrame(int state, int frame) {
-  delete states[state]->frames.takeAt(frame);
+  states[state]->frames.remove(frame);
+  states[state]->updateTimes();
 }
 
 void Sprite::setDuration(int state, int frame, int duration) {
   if(state < states.size()) {
     if(frame < states[state]->frames.size()) {
-      int time_diff = duration - states[state]->frames[frame]->duration;
-      int i;
-
-      states[state]->frames[frame]->duration = duration;
-
-      for(i = frame; i < states[state]->frames.size(); i++)
-	      states[state]->frames[i]->end_time += time_diff;
-
-      states[state]->max_time += time_diff;
+      states[state]->frames[frame].duration = duration;
+      states[state]->updateTimes();
     }
   }   
 }
@@ -261,7 +238,7 @@ void Sprite::setBitmap(int state, int frame, int bitmap) {
   //cout << "SetBitmap " << state << " " << frame << " " << bitmap << "\n";
   if(state >= 0 && state < states.size()) {
     if(frame >= 0 && frame < states[state]->frames.size()) {
-      states[state]->frames[frame]->bitmap = bitmap;
+      states[state]->frames[frame].bitmap = bitmap;
     }
   }
 }
@@ -280,7 +257,7 @@ int Sprite::getFrameCount(int state) const {
 int Sprite::getDuration(int state, int frame) const {
   if(state < states.size()) {
     if(frame < states[state]->frames.size()) {
-      return states[state]->frames[frame]->duration;
+      return states[state]->frames[frame].duration;
     }
   }
   return 0;
@@ -289,7 +266,7 @@ int Sprite::getDuration(int state, int frame) const {
 int Sprite::getBitmap(int state, int frame) const {
   if(state >= 0 && state < states.size()) {
     if(frame >= 0 && frame < states[state]->frames.size()) {
-      return states[state]->frames[frame]->bitmap;
+      return states[state]->frames[frame].bitmap;
     }
   }
   return 0;
@@ -332,9 +309,33 @@ Sprite::State::State() {
   max_time = 0;
 }
 
-Sprite::State::~State() {
-  while(!frames.isEmpty())
-    delete frames.takeFirst();
+void Sprite::State::updateTimes() {
+  max_time = 0;
+  for(int i = 0; i < frames.size(); i++) {
+    max_time += frames[i].duration;
+    frames[i].end_time = max_time;
+  }
+}
+
+// The first frame whose end time is at or after "time".
+int Sprite::State::frameAt(int time) const {
+  if(frames.isEmpty()) return -1;
+
+  if(loop >= 0) {
+    if(max_time > 0) time %= max_time;
+  } else if(time > max_time) {
+    time = max_time;
+  }
+
+  Frame key;
+  key.end_time = time;
+  QVector <Frame>::const_iterator i = qLowerBound(frames.constBegin(), frames.constEnd(), key, frame_end_order);
+  if(i == frames.constEnd()) return -1;
+  return i - frames.constBegin();
+}
+
+bool Sprite::frame_end_order(const Frame & a, const Frame & b) {
+  return a.end_time < b.end_time;
 }
 
 void SpriteReader::tokenDebug()
@@ -349,10 +350,28 @@ void SpriteReader::tokenDebug()
   }
 }
 
+SpriteReader::SpriteReader()
+{
+  hasSprite = false;
+}
+
 Sprite * SpriteReader::read(QIODevice * device)
+{
+  parse(device);
+  return create();
+}
+
+Sprite * SpriteReader::read(QString filename)
+{
+  parse(filename);
+  return create();
+}
+
+bool SpriteReader::parse(QIODevice * device)
 {
   setDevice(device);
-  sprite = 0;
+  hasSprite = hasName = hasTileset = hasOrigin = hasBoundingBox = false;
+  states.clear();
 
   while (!atEnd()) {
     readNext();
@@ -364,23 +383,52 @@ Sprite * SpriteReader::read(QIODevice * device)
     }
   }
 
-  if(!error())
-    return sprite;
-  else
-    return 0;
+  setDevice(0);
+  if(error()) hasSprite = false;
+  return hasSprite;
 }
 
-Sprite * SpriteReader::read(QString filename)
+bool SpriteReader::parse(QString filename)
 {
   QFile f(filename);
   f.open(QIODevice::ReadOnly);
-  return read(&f);
+  return parse(&f);
+}
+
+Sprite * SpriteReader::create()
+{
+  if(!hasSprite)
+    return 0;
+
+  Sprite * sprite = new Sprite();
+
+  if(hasName)
+    sprite->setName(spriteName);
+  if(hasTileset)
+    sprite->setTileset(bitmaps[bitmapnames[tilesetName]]);
+  if(hasOrigin)
+    sprite->setOrigin(x_origin, y_origin);
+  if(hasBoundingBox)
+    sprite->setBoundingBox(x1, y1, x2, y2);
+
+  for(int i = 0; i < states.size(); i++) {
+    sprite->addState();
+    if(states[i].hasName)
+      sprite->setStateName(i, states[i].name);
+    for(int j = 0; j < states[i].frames.size(); j++)
+      sprite->addFrame(i, states[i].frames[j].duration, states[i].frames[j].bitmap);
+  }
+
+  states.clear();
+  hasSprite = false;
+
+  return sprite;
 }
 
 void SpriteReader::readSprite()
 {
   Q_ASSERT(isStartElement() && name() == "sprite");
-  sprite = new Sprite();
+  hasSprite = true;
 
   while (!atEnd()) {
     readNext();
@@ -392,7 +440,8 @@ void SpriteReader::readSprite()
     if (isStartElement()) {
       if (name() == "name")
       {
-        sprite->setName(readElementText());
+        spriteName = readElementText();
+        hasName = true;
       }
       else if (name() == "state")
       {
@@ -400,14 +449,15 @@ void SpriteReader::readSprite()
       }
       else if (name() == "tileset")
       {
-        sprite->setTileset(bitmaps[bitmapnames[readElementText()]]);
+        tilesetName = readElementText();
+        hasTileset = true;
       }
       else if (name() == "origin")
       {
         QXmlStreamAttributes a = attributes();
-        int x = a.value("x").toString().toInt();
-        int y = a.value("y").toString().toInt();
-        sprite->setOrigin(x, y);
+        x_origin = a.value("x").toString().toInt();
+        y_origin = a.value("y").toString().toInt();
+        hasOrigin = true;
 
         // Advance the parser.
         readElementText();
@@ -415,11 +465,11 @@ void SpriteReader::readSprite()
       else if (name() == "boundingbox")
       {
         QXmlStreamAttributes a = attributes();
-        int x1 = a.value("x1").toString().toInt();
-        int y1 = a.value("y1").toString().toInt();
-        int x2 = a.value("x2").toString().toInt();
-        int y2 = a.value("y2").toString().toInt();
-        sprite->setBoundingBox(x1, y1, x2, y2);        
+        x1 = a.value("x1").toString().toInt();
+        y1 = a.value("y1").toString().toInt();
+        x2 = a.value("x2").toString().toInt();
+        y2 = a.value("y2").toString().toInt();
+        hasBoundingBox = true;
 
         // Advance the parser.
         readElementText();
@@ -435,10 +485,9 @@ void SpriteReader::readSprite()
 void SpriteReader::readState()
 {
   Q_ASSERT(isStartElement() && name() == "state");
-  sprite->addState();
-  int currentState = sprite->getStateCount() - 1;
+  StateData state;
+  state.hasName = false;
 
-  QString stateName;
   QString loop;
 
   while (!atEnd()) {
@@ -454,12 +503,12 @@ void SpriteReader::readState()
       }
       else if (name() == "name")
       {
-        stateName = readElementText();
-        sprite->setStateName(currentState, stateName);
+        state.name = readElementText();
+        state.hasName = true;
       }
       else if (name() == "frame")
       {
-        readFrame(currentState);
+        readFrame(state);
       }
       else
       {
@@ -467,9 +516,11 @@ void SpriteReader::readState()
       }
     }
   }
+
+  states.append(state);
 }
 
-void SpriteReader::readFrame(int currentState)
+void SpriteReader::readFrame(StateData & state)
 {
   Q_ASSERT(isStartElement() && name() == "frame");
   QString bitmap;
@@ -498,7 +549,10 @@ void SpriteReader::readFrame(int currentState)
     }
   }
 
-  sprite->addFrame(currentState, duration.toInt(), bitmap.toInt());
+  FrameData frame;
+  frame.duration = duration.toInt();
+  frame.bitmap = bitmap.toInt();
+  state.frames.append(frame);
 }
 
 void SpriteReader::readUnknownElement()
@@ -40,6 +40,7 @@ public:
   int getDuration(int state, int frame) const;
   int getBitmap(int state, int frame) const;
   int getId() const { return id; }
+  int getFrameAt(int state, int time) const;
   QString getStateName(int state) const { return states[state]->name; }
   void setStateName(int state, QString stateName) { states[state]->name = stateName; }
 
@@ -57,15 +58,20 @@ protected:
     int bitmap;
   };
 
+  // Frames are kept by value with cumulative end times, so the frame
+  // showing at a given time can be found with a binary search.
   struct State {
-    QList <Frame *> frames;
+    QVector <Frame> frames;
     int max_time;
     int loop;
     QString name;
     State();
-    ~State();
+    void updateTimes();
+    int frameAt(int time) const;
   };
 
+  static bool frame_end_order(const Frame & a, const Frame & b);
+
   QList <State *> states;
   Bitmap * bitmap;
   Resource * thisSprite;
@@ -73,20 +79,44 @@ protected:
   int id;
 };
 
+// Like MapReader, parse() can run on a worker thread and create() then
+// builds and registers the Sprite on the GUI thread.
 class SpriteReader : public QXmlStreamReader
 {
 public:
+  SpriteReader();
+
   Sprite * read(QIODevice * device);
   Sprite * read(QString filename);
 
+  bool parse(QIODevice * device);
+  bool parse(QString filename);
+  Sprite * create();
+
 private:
+  struct FrameData {
+    int duration;
+    int bitmap;
+  };
+
+  struct StateData {
+    bool hasName;
+    QString name;
+    QList < FrameData > frames;
+  };
+
   void readSprite();
   void readState();
-  void readFrame(int currentState);
+  void readFrame(StateData & state);
   void readUnknownElement();
   void tokenDebug();
 
-  Sprite * sprite;
+  bool hasSprite, hasName, hasTileset, hasOrigin, hasBoundingBox;
+  QString spriteName;
+  QString tilesetName;
+  int x_origin, y_origin;
+  int x1, y1, x2, y2;
+  QList < StateData > states;
 };
 
 #endif
@@ -5,6 +5,7 @@
 #include "spritewidget.h"
 #include "sprite.h"
 #include "globals.h"
+#include "tilebatch.h"
 
 #include <qgl.h>
 #include <qdatetime.h>
@@ -59,6 +60,7 @@ void SpriteWidget::resizeGL(int w, int h) {
 }
 
 void SpriteWidget::paintGL() {
+  TileBatch::resetBinding();
   glClearColor( 0.5, 0.5, 0.5, 0.0 ); 
   glClear(GL_COLOR_BUFFER_BIT);
   int x = (width() - sw) / 2;
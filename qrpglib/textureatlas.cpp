@@ -0,0 +1,207 @@
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include <GL/gl.h>
+#include <QtCore>
+#include <QImage>
+#include <qgl.h>
+#include "globals.h"
+#include "bitmap.h"
+#include "map.h"
+#include "tilebatch.h"
+#include "textureresidency.h"
+#include "textureatlas.h"
+
+QList < TextureAtlas::Page > TextureAtlas::pages;
+
+static bool placementHeightOrder(const QPair < int, int > & a, const QPair < int, int > & b) {
+  return a.first > b.first;
+}
+
+void TextureAtlas::build() {
+  int i;
+
+  // Nothing is drawn headless, so there is nothing to pack.
+  if(headless) return;
+
+  if(mainGLWidget) mainGLWidget->makeCurrent();
+  clear();
+
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  int pageSize = MaxPageSize;
+  if(maxSize > 0 && maxSize < pageSize) pageSize = maxSize;
+
+  // Load every image up front and pack the tallest ones first.
+  QList < Placement > placements;
+  QList < QPair < int, int > > order;
+  for(i = 0; i < bitmaps.size(); i++) {
+    Placement p;
+    p.bitmap = bitmaps[i];
+    p.image = bitmaps[i]->getImage().convertToFormat(QImage::Format_ARGB32);
+    p.page = -1;
+    p.x = p.y = 0;
+
+    if(p.image.isNull() ||
+       p.image.width() + Padding * 2 > pageSize ||
+       p.image.height() + Padding * 2 > pageSize) {
+      // Leave it with its own texture.
+      continue;
+    }
+
+    placements.push_back(p);
+    order.push_back(QPair < int, int >(p.image.height(), placements.size() - 1));
+  }
+  qStableSort(order.begin(), order.end(), placementHeightOrder);
+
+  // Shelf packing: fill rows left to right, start a new row when one is full
+  // and a new page when the rows run out.  Pages are counted at full size
+  // against the limit; whatever is left over when it is reached stays out.
+  qint64 limit = (qint64) TextureResidency::getBudget() * 1024 * 1024 / 2;
+  qint64 pageBytes = (qint64) pageSize * pageSize * 4;
+  QList < int > pageHeights;
+  int shelf_x = 0, shelf_y = 0, shelf_h = 0;
+  for(i = 0; i < order.size(); i++) {
+    Placement & p = placements[order[i].second];
+    int w = p.image.width() + Padding * 2;
+    int h = p.image.height() + Padding * 2;
+
+    if(pageHeights.isEmpty()) {
+      if(pageBytes > limit) break;
+      pageHeights.push_back(0);
+    }
+
+    if(shelf_x + w > pageSize) {
+      shelf_y += shelf_h;
+      shelf_x = 0;
+      shelf_h = 0;
+    }
+    if(shelf_y + h > pageSize) {
+      if((pageHeights.size() + 1) * pageBytes > limit) break;
+      pageHeights.push_back(0);
+      shelf_x = shelf_y = shelf_h = 0;
+    }
+
+    p.page = pageHeights.size() - 1;
+    p.x = shelf_x + Padding;
+    p.y = shelf_y + Padding;
+
+    shelf_x += w;
+    if(h > shelf_h) shelf_h = h;
+    pageHeights.last() = qMax(pageHeights.last(), shelf_y + shelf_h);
+  }
+
+  for(i = 0; i < pageHeights.size(); i++) {
+    Page page;
+    page.width = pageSize;
+    page.height = pow2(pageHeights[i]);
+    page.usedPixels = 0;
+    page.bitmapCount = 0;
+
+    QImage image(page.width, page.height, QImage::Format_ARGB32);
+    image.fill(0);
+
+    for(int j = 0; j < placements.size(); j++) {
+      Placement & p = placements[j];
+      if(p.page != i) continue;
+      blit(image, p.image, p.x, p.y);
+      page.usedPixels += p.image.width() * p.image.height();
+      page.bitmapCount++;
+    }
+
+    QImage texture = QGLWidget::convertToGLFormat(image);
+
+    glGenTextures(1, &page.texture);
+    TileBatch::bindTexture(page.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+                 texture.width(), texture.height(),
+                 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 texture.bits());
+
+    for(int j = 0; j < placements.size(); j++) {
+      Placement & p = placements[j];
+      if(p.page != i) continue;
+      p.bitmap->setAtlas(page.texture, page.width, page.height,
+                         p.x, p.y, p.image.width(), p.image.height());
+    }
+
+    pages.push_back(page);
+  }
+
+  // Any cached tile geometry still points at the old texture coordinates.
+  for(i = 0; i < maps.size(); i++) {
+    for(int l = 0; l < maps[i]->getLayerCount(); l++) {
+      maps[i]->getLayer(l)->invalidateAll();
+    }
+  }
+}
+
+void TextureAtlas::clear() {
+  int i;
+  for(i = 0; i < bitmaps.size(); i++) {
+    if(bitmaps[i]->isInAtlas()) bitmaps[i]->clearAtlas();
+  }
+
+  for(i = 0; i < pages.size(); i++) {
+    glDeleteTextures(1, &pages[i].texture);
+  }
+  pages.clear();
+  TileBatch::resetBinding();
+}
+
+QString TextureAtlas::report() {
+  QString r = QString("Texture atlas: %1 page(s)").arg(pages.size());
+
+  for(int i = 0; i < pages.size(); i++) {
+    r += QString("\n  page %1: %2x%3, %4 bitmap(s), %5% used")
+      .arg(i)
+      .arg(pages[i].width)
+      .arg(pages[i].height)
+      .arg(pages[i].bitmapCount)
+      .arg(100.0 * pages[i].usedPixels / (pages[i].width * pages[i].height), 0, 'f', 1);
+  }
+
+  r += QString("\n  %1 KB of %2 MB texture budget").arg(textureBytes() / 1024).arg(TextureResidency::getBudget());
+  r += QString("\n  last frame: %1 texture bind(s), %2 bind(s) saved")
+    .arg(TileBatch::getBinds())
+    .arg(TileBatch::getBindsSaved());
+
+  return r;
+}
+
+qint64 TextureAtlas::textureBytes() {
+  qint64 total = 0;
+  for(int i = 0; i < pages.size(); i++) {
+    total += (qint64) pages[i].width * pages[i].height * 4;
+  }
+  return total;
+}
+
+void TextureAtlas::blit(QImage & dest, const QImage & src, int x, int y) {
+  int w = src.width();
+  int h = src.height();
+
+  // Copy the image and extrude its outermost pixels into the padding.
+  for(int j = -Padding; j < h + Padding; j++) {
+    int sy = qBound(0, j, h - 1);
+    const QRgb * in = (const QRgb *) src.constScanLine(sy);
+    QRgb * out = (QRgb *) dest.scanLine(y + j);
+    for(int i = -Padding; i < w + Padding; i++) {
+      out[x + i] = in[qBound(0, i, w - 1)];
+    }
+  }
+}
+
+int TextureAtlas::pow2(int x) {
+  int a = 1;
+
+  while(x > a) {
+    a *= 2;
+  }
+  return a;
+}
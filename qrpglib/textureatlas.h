@@ -0,0 +1,50 @@
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H 1
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+#include <GL/gl.h>
+#include <QtCore>
+#include <QImage>
+
+class Bitmap;
+
+/* Packs the images of every loaded Bitmap into a few large textures so that
+   tiles and sprites from different sheets can be drawn without rebinding.
+   Pages can't be evicted, so they take at most half of the TextureResidency
+   budget; bitmaps that don't fit keep their own, evictable textures. */
+
+class TextureAtlas {
+public:
+  static void build();
+  static void clear();
+  static QString report();
+  static qint64 textureBytes();
+
+private:
+  // Pixels of extruded border around each image so GL_NEAREST never samples
+  // a neighbouring image.
+  enum { Padding = 2, MaxPageSize = 2048 };
+
+  struct Page {
+    GLuint texture;
+    int width, height;
+    int usedPixels;
+    int bitmapCount;
+  };
+
+  struct Placement {
+    Bitmap * bitmap;
+    QImage image;
+    int page;
+    int x, y;
+  };
+
+  static void blit(QImage & dest, const QImage & src, int x, int y);
+  static int pow2(int x);
+
+  static QList < Page > pages;
+};
+
+#endif
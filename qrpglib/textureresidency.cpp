@@ -0,0 +1,155 @@
+#include <QtCore>
+#include "textureresidency.h"
+#include "bitmap.h"
+#include "sprite.h"
+#include "map.h"
+#include "entity.h"
+#include "textureatlas.h"
+#include "globals.h"
+
+QList < Bitmap * > TextureResidency::urgent;
+QList < Bitmap * > TextureResidency::uploading;
+int TextureResidency::frame = 0;
+int TextureResidency::budget = 128;
+int TextureResidency::evictions = 0;
+bool TextureResidency::rebuildAtlas = false;
+
+void TextureResidency::beginFrame() {
+  frame++;
+  if(rebuildAtlas) {
+    rebuildAtlas = false;
+    TextureAtlas::build();
+  }
+  evict();
+
+  // The map being shown gets all of its textures before its first frame;
+  // their decoding has been running since prefetch().
+  while(!urgent.isEmpty()) {
+    Bitmap * b = urgent.takeFirst();
+    uploading.removeAll(b);
+    if(!b->isUploaded()) b->unStub();
+  }
+
+  // Everything else is uploaded a few at a time as the workers finish.
+  qint64 uploaded = 0;
+  for(int i = 0; i < uploading.size() && uploaded < UploadBytesPerFrame; ) {
+    Bitmap * b = uploading[i];
+    if(b->isUploaded()) {
+      uploading.removeAt(i);
+    } else if(b->isPrepared()) {
+      b->unStub();
+      uploaded += b->textureBytes();
+      uploading.removeAt(i);
+    } else {
+      i++;
+    }
+  }
+}
+
+// Headless there is no GL context, so nothing is ever uploaded.
+void TextureResidency::request(Bitmap * bitmap) {
+  if(headless) return;
+  if(bitmap->isUploaded() || uploading.contains(bitmap)) return;
+  bitmap->requestUpload();
+  uploading.append(bitmap);
+}
+
+void TextureResidency::prefetch(Map * map) {
+  if(headless) return;
+  QList < Bitmap * > needed = bitmapsFor(map);
+  for(int i = 0; i < needed.size(); i++) {
+    if(needed[i]->isUploaded() || urgent.contains(needed[i])) continue;
+    request(needed[i]);
+    urgent.append(needed[i]);
+  }
+}
+
+void TextureResidency::preload(QList < Bitmap * > needed) {
+  for(int i = 0; i < needed.size(); i++) {
+    request(needed[i]);
+  }
+}
+
+bool TextureResidency::isPending(Bitmap * bitmap) {
+  return uploading.contains(bitmap) || urgent.contains(bitmap);
+}
+
+void TextureResidency::forget(Bitmap * bitmap) {
+  urgent.removeAll(bitmap);
+  uploading.removeAll(bitmap);
+}
+
+// The map's tilesets and the ones used by its entities' sprites.
+QList < Bitmap * > TextureResidency::bitmapsFor(Map * map) {
+  QList < Bitmap * > result;
+  if(!map) return result;
+  if(map->getTileset()) result.append(map->getTileset());
+
+  for(int l = 0; l < map->getLayerCount(); l++) {
+    Map::Layer * layer = map->getLayer(l);
+    if(layer->tileset && !result.contains(layer->tileset))
+      result.append(layer->tileset);
+
+    QList < EntityPointer > entities = layer->startEntities + layer->entities;
+    for(int i = 0; i < entities.size(); i++) {
+      Sprite * s = entities[i]->getSprite();
+      if(s && s->getTileset() && !result.contains(s->getTileset()))
+        result.append(s->getTileset());
+    }
+  }
+  return result;
+}
+
+void TextureResidency::setBudget(int megabytes) {
+  // Evicting and repacking need the GL context, so they wait for the next frame.
+  if(megabytes == budget) return;
+  budget = megabytes;
+  rebuildAtlas = true;
+}
+
+int TextureResidency::getBudget() {
+  return budget;
+}
+
+qint64 TextureResidency::residentBytes() {
+  qint64 total = TextureAtlas::textureBytes();
+  for(int i = 0; i < bitmaps.size(); i++) {
+    if(bitmaps[i]) total += bitmaps[i]->textureBytes();
+  }
+  return total;
+}
+
+QString TextureResidency::report() {
+  int resident = 0, stubbed = 0, atlased = 0;
+  for(int i = 0; i < bitmaps.size(); i++) {
+    if(!bitmaps[i]) continue;
+    if(bitmaps[i]->isInAtlas()) atlased++;
+    else if(bitmaps[i]->isUploaded()) resident++;
+    else stubbed++;
+  }
+
+  return QString("%1 texture(s) resident (%2 KB of %3 MB budget), %4 not resident, "
+                 "%5 in the atlas (%6 KB), %7 eviction(s)")
+    .arg(resident).arg(residentBytes() / 1024).arg(budget)
+    .arg(stubbed).arg(atlased).arg(TextureAtlas::textureBytes() / 1024).arg(evictions);
+}
+
+void TextureResidency::evict() {
+  qint64 limit = (qint64) budget * 1024 * 1024;
+  qint64 total = residentBytes();
+
+  while(total > limit) {
+    // Anything drawn last frame or this one stays.
+    Bitmap * oldest = 0;
+    for(int i = 0; i < bitmaps.size(); i++) {
+      Bitmap * b = bitmaps[i];
+      if(!b || !b->textureBytes() || b->getLastUsed() >= frame - 1) continue;
+      if(!oldest || b->getLastUsed() < oldest->getLastUsed()) oldest = b;
+    }
+    if(!oldest) break;
+
+    total -= oldest->textureBytes();
+    oldest->stub();
+    evictions++;
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef TEXTURERESIDENCY_H
+#define TEXTURERESIDENCY_H 1
+
+#include <QtCore>
+
+class Bitmap;
+class Map;
+
+/* Keeps the GL textures of Bitmaps within a memory budget.  Bitmaps note the
+   frame they were last drawn in; at the start of each frame the least
+   recently used textures are stubbed until the budget is met.  Stubbed
+   bitmaps keep their decoded image, so bringing one back is just an upload.
+   Atlas pages count against the budget but are never evicted; the atlas
+   is rebuilt when the budget changes so it keeps to its half.
+
+   Images are decoded and converted on the thread pool (see
+   Bitmap::requestUpload); the GL uploads are done at the start of a frame,
+   when the context is current, a few at a time. */
+
+class TextureResidency {
+public:
+  // Called at the top of MapScene::drawBackground.
+  static void beginFrame();
+  static int currentFrame() { return frame; }
+
+  // Queues an upload; it lands in a later beginFrame().
+  static void request(Bitmap * bitmap);
+  // Everything the map needs is uploaded before its first frame is drawn.
+  static void prefetch(Map * map);
+  // Uploaded as they get decoded, for maps that aren't shown yet.
+  static void preload(QList < Bitmap * > needed);
+  static bool isPending(Bitmap * bitmap);
+  static void forget(Bitmap * bitmap);
+  static QList < Bitmap * > bitmapsFor(Map * map);
+
+  static void setBudget(int megabytes);
+  static int getBudget();
+  static qint64 residentBytes();
+  static QString report();
+
+private:
+  static void evict();
+
+  enum { UploadBytesPerFrame = 1024 * 1024 };
+
+  static QList < Bitmap * > urgent;
+  static QList < Bitmap * > uploading;
+  static int frame;
+  static int budget;
+  static int evictions;
+  static bool rebuildAtlas;
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include <GL/gl.h>
+#include <QtCore>
+#include "tilebatch.h"
+
+int TileBatch::drawCalls = 0;
+int TileBatch::lastFrameDrawCalls = 0;
+GLuint TileBatch::boundTexture = 0;
+int TileBatch::binds = 0;
+int TileBatch::bindsSaved = 0;
+int TileBatch::lastFrameBinds = 0;
+int TileBatch::lastFrameBindsSaved = 0;
+
+TileBatch::TileBatch() {
+}
+
+void TileBatch::clear() {
+  // resize() keeps the allocated capacity around for the next frame.
+  vertices.resize(0);
+  texcoords.resize(0);
+}
+
+void TileBatch::addQuad(float x, float y, float w, float h,
+                        float tx1, float ty1, float tx2, float ty2) {
+  // Same corner order and texture mapping as Bitmap::draw.
+  vertices << x << y + h
+           << x << y
+           << x + w << y
+           << x + w << y + h;
+
+  texcoords << tx1 << ty1
+            << tx1 << ty2
+            << tx2 << ty2
+            << tx2 << ty1;
+}
+
+int TileBatch::quadCount() const {
+  return vertices.size() / 8;
+}
+
+void TileBatch::draw(GLuint texture, float opacity) {
+  if(vertices.isEmpty()) return;
+
+  glEnable(GL_TEXTURE_2D);
+  glEnable(GL_BLEND);   // Turn Blending On
+  if(opacity == 1.0)
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+  else
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glColor4f(1.0, 1.0, 1.0, opacity);
+  bindTexture(texture);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, vertices.constData());
+  glTexCoordPointer(2, GL_FLOAT, 0, texcoords.constData());
+  glDrawArrays(GL_QUADS, 0, vertices.size() / 2);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  glDisable(GL_TEXTURE_2D);
+  countDrawCall();
+}
+
+void TileBatch::countDrawCall() {
+  drawCalls++;
+}
+
+void TileBatch::endFrame() {
+  lastFrameDrawCalls = drawCalls;
+  drawCalls = 0;
+  lastFrameBinds = binds;
+  lastFrameBindsSaved = bindsSaved;
+  binds = bindsSaved = 0;
+  resetBinding();
+}
+
+int TileBatch::getDrawCalls() {
+  return lastFrameDrawCalls;
+}
+
+void TileBatch::bindTexture(GLuint texture) {
+  if(texture == boundTexture) {
+    bindsSaved++;
+    return;
+  }
+  glBindTexture(GL_TEXTURE_2D, texture);
+  boundTexture = texture;
+  binds++;
+}
+
+void TileBatch::resetBinding() {
+  boundTexture = 0;
+}
+
+int TileBatch::getBinds() {
+  return lastFrameBinds;
+}
+
+int TileBatch::getBindsSaved() {
+  return lastFrameBindsSaved;
+}
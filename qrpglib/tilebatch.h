@@ -0,0 +1,44 @@
+#ifndef TILEBATCH_H
+#define TILEBATCH_H 1
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+#include <GL/gl.h>
+#include <QtCore>
+
+/* Collects textured quads that share a texture so they can be submitted
+   with a single glDrawArrays call instead of one glBegin/glEnd per quad. */
+
+class TileBatch {
+public:
+  TileBatch();
+  void clear();
+  void addQuad(float x, float y, float w, float h,
+               float tx1, float ty1, float tx2, float ty2);
+  int quadCount() const;
+  void draw(GLuint texture, float opacity = 1.0);
+
+  static void countDrawCall();
+  static void endFrame();
+  static int getDrawCalls();
+
+  // Binds skip the GL call when the texture is already bound.  Call
+  // resetBinding() whenever something outside this class binds a texture.
+  static void bindTexture(GLuint texture);
+  static void resetBinding();
+  static int getBinds();
+  static int getBindsSaved();
+
+private:
+  QVector < GLfloat > vertices;
+  QVector < GLfloat > texcoords;
+
+  static int drawCalls;
+  static int lastFrameDrawCalls;
+  static GLuint boundTexture;
+  static int binds, bindsSaved;
+  static int lastFrameBinds, lastFrameBindsSaved;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include <limits.h>
+#include "tiledataparser.h"
+
+TileDataParser::TileDataParser(int * data, int width, int height) {
+  this->data = data;
+  this->width = width;
+  this->height = height;
+  parsed = 0;
+  value = 0;
+  inNumber = false;
+  negative = false;
+  tiledGids = false;
+}
+
+// Gids are then unsigned 32 bit numbers.  The engine can't draw flipped
+// tiles, so the horizontal, vertical and diagonal flip bits are dropped
+// and the plain tile is used.
+void TileDataParser::setTiledGids(bool tiled) {
+  tiledGids = tiled;
+}
+
+bool TileDataParser::feed(const QStringRef & text) {
+  if(!error.isEmpty()) return false;
+
+  const QChar * c = text.unicode();
+  const QChar * end = c + text.size();
+
+  for(; c != end; c++) {
+    ushort u = c->unicode();
+    if(u >= '0' && u <= '9') {
+      value = value * 10 + (u - '0');
+      inNumber = true;
+      if(value > UINT_MAX) return fail(QObject::tr("number too large"));
+    } else if(u == '-' && !inNumber && !negative) {
+      negative = true;
+    } else if(c->isSpace() || u == ',') {
+      if(!endValue()) return false;
+    } else {
+      return fail(QObject::tr("unexpected character '%1'").arg(*c));
+    }
+  }
+
+  return true;
+}
+
+// Ends the number currently being read, if any.
+bool TileDataParser::endValue() {
+  if(!error.isEmpty()) return false;
+
+  if(!inNumber) {
+    if(negative) return fail(QObject::tr("'-' without a number"));
+    return true;
+  }
+
+  if(parsed >= width * height)
+    return fail(QObject::tr("more than %1 tiles for a %2x%3 layer")
+                .arg(width * height).arg(width).arg(height));
+
+  if(tiledGids)
+    value &= ~Q_INT64_C(0xE0000000);
+  else if(value > INT_MAX)
+    return fail(QObject::tr("number too large"));
+
+  data[parsed++] = negative ? (int) -value : (int) value;
+  value = 0;
+  inNumber = false;
+  negative = false;
+  return true;
+}
+
+bool TileDataParser::finish() {
+  if(!endValue()) return false;
+
+  if(parsed < width * height)
+    return fail(QObject::tr("only %1 of %2 tiles for a %3x%4 layer")
+                .arg(parsed).arg(width * height).arg(width).arg(height));
+
+  return true;
+}
+
+int TileDataParser::count() const {
+  return parsed;
+}
+
+QString TileDataParser::errorString() const {
+  return error;
+}
+
+bool TileDataParser::fail(QString e) {
+  // Say which tile we were on, that's what you need to fix the file.
+  error = QObject::tr("Bad layer data at tile %1 (%2, %3): %4")
+    .arg(parsed)
+    .arg(width ? parsed % width : 0)
+    .arg(width ? parsed / width : 0)
+    .arg(e);
+  return false;
+}
@@ -0,0 +1,35 @@
+#ifndef TILEDATAPARSER_H
+#define TILEDATAPARSER_H 1
+
+#include <QtCore>
+
+/* Parses whitespace (or comma) separated tile numbers straight into a
+   layer's tile buffer.  Text can be fed in pieces as the XML reader hands
+   out character tokens, so numbers split across tokens are handled and
+   nothing is copied into intermediate strings or lists. */
+
+class TileDataParser {
+public:
+  TileDataParser(int * data, int width, int height);
+  // Tiled stores flipped tiles with flags in the top bits of the gid.
+  void setTiledGids(bool tiled);
+  bool feed(const QStringRef & text);
+  bool endValue();
+  bool finish();
+  int count() const;
+  QString errorString() const;
+
+private:
+  bool fail(QString e);
+
+  int * data;
+  int width, height;
+  int parsed;
+  qint64 value;
+  bool inNumber;
+  bool negative;
+  bool tiledGids;
+  QString error;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include <string.h>
+#include "tileops.h"
+
+// Copies a w x h block from (sx, sy) in src to (dx, dy) in dst.  With
+// skipZero, empty (<= 0) source tiles leave the destination alone.
+void TileOps::copy(const int * src, int src_w, int src_h, int sx, int sy,
+                   int * dst, int dst_w, int dst_h, int dx, int dy,
+                   int w, int h, bool skipZero) {
+  // Trim the block so it lies inside both arrays.
+  int cut;
+  cut = qMax(-sx, -dx);
+  if(cut > 0) { sx += cut; dx += cut; w -= cut; }
+  cut = qMax(-sy, -dy);
+  if(cut > 0) { sy += cut; dy += cut; h -= cut; }
+  w = qMin(w, qMin(src_w - sx, dst_w - dx));
+  h = qMin(h, qMin(src_h - sy, dst_h - dy));
+  if(w <= 0 || h <= 0) return;
+
+  for(int y = 0; y < h; y++) {
+    const int * s = src + sx + (sy + y) * src_w;
+    int * d = dst + dx + (dy + y) * dst_w;
+    if(skipZero) {
+      for(int x = 0; x < w; x++) d[x] = s[x] > 0 ? s[x] : d[x];
+    } else {
+      memmove(d, s, w * sizeof(int));
+    }
+  }
+}
+
+void TileOps::fill(int * dst, int dst_w, int dst_h, int x, int y, int w, int h, int tile) {
+  if(x < 0) { w += x; x = 0; }
+  if(y < 0) { h += y; y = 0; }
+  w = qMin(w, dst_w - x);
+  h = qMin(h, dst_h - y);
+  if(w <= 0 || h <= 0) return;
+
+  for(int row = y; row < y + h; row++) {
+    int * d = dst + x + row * dst_w;
+    if(tile == 0) {
+      memset(d, 0, w * sizeof(int));
+    } else {
+      for(int i = 0; i < w; i++) d[i] = tile;
+    }
+  }
+}
+
+// Returns how many tiles were changed.
+int TileOps::replace(int * data, int count, int from, int to) {
+  int changed = 0;
+  for(int i = 0; i < count; i++) {
+    int match = data[i] == from;
+    changed += match;
+    data[i] = match ? to : data[i];
+  }
+  return changed;
+}
+
+// A new w x h array holding src's top left corner, padded with fill.
+int * TileOps::resized(const int * src, int src_w, int src_h, int w, int h, int fill) {
+  int * data = new int[w * h];
+  TileOps::fill(data, w, h, 0, 0, w, h, fill);
+  copy(src, src_w, src_h, 0, 0, data, w, h, 0, 0, qMin(w, src_w), qMin(h, src_h));
+  return data;
+}
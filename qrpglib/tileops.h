@@ -0,0 +1,20 @@
+#ifndef TILEOPS_H
+#define TILEOPS_H 1
+
+#include <QtCore>
+
+/* Bulk operations on row-major tile arrays.  Every operation clips against
+   both arrays and then works a row at a time, with memcpy and fill loops
+   the compiler can vectorize instead of a bounds test per tile. */
+
+class TileOps {
+public:
+  static void copy(const int * src, int src_w, int src_h, int sx, int sy,
+                   int * dst, int dst_w, int dst_h, int dx, int dy,
+                   int w, int h, bool skipZero = false);
+  static void fill(int * dst, int dst_w, int dst_h, int x, int y, int w, int h, int tile);
+  static int replace(int * data, int count, int from, int to);
+  static int * resized(const int * src, int src_w, int src_h, int w, int h, int fill);
+};
+
+#endif
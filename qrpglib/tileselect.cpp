@@ -5,6 +5,7 @@
 #include "tileselect.h"
 #include "bitmap.h"
 #include "globals.h"
+#include "tilebatch.h"
 
 #include <qwidget.h>
 #include <qlayout.h>
@@ -73,6 +74,7 @@ void TileBox::resizeGL(int w, int h) {
 }
 
 void TileBox::paintGL() {
+  TileBatch::resetBinding();
   glPushMatrix();
   glClearColor( 0.5, 0.5, 0.5, 0.0 ); 
   glClear(GL_COLOR_BUFFER_BIT);
@@ -0,0 +1,119 @@
+#include <QtCore>
+#include "trace.h"
+#include "profiler.h"
+#include "globals.h"
+
+bool Trace::recording = false;
+QVector < Trace::Event > Trace::events;
+QString Trace::file;
+qint64 Trace::startTime = 0;
+qint64 Trace::length = 0;
+int Trace::dropped = 0;
+
+void Trace::start(int seconds, QString f) {
+  if(recording) stop();
+
+  Profiler::startClock();
+  events.clear();
+  file = f.isEmpty() ? "trace.json" : f;
+  startTime = Profiler::now();
+  length = qMax(seconds, 0) * Q_INT64_C(1000000000);
+  dropped = 0;
+  recording = true;
+  Profiler::setTracing(true);
+  cprint("Tracing to " + file);
+}
+
+bool Trace::stop() {
+  if(!recording) return false;
+  recording = false;
+  Profiler::setTracing(false);
+
+  bool ok = write();
+  QString result = ok ? QString("Wrote %1 trace event(s) to %2").arg(events.size()).arg(file)
+                      : "Could not write " + file;
+  if(dropped) result += QString(", %1 dropped").arg(dropped);
+  cprint(result);
+
+  events.clear();
+  events.squeeze();
+  return ok;
+}
+
+void Trace::slice(const char * name, const char * category,
+                  qint64 start, qint64 end, const QString & args) {
+  // Slices that began before the trace did are cut off by start().
+  if(!recording || start < startTime) return;
+  if(events.size() >= MaxEvents) {
+    dropped++;
+    return;
+  }
+
+  Event e;
+  e.name = name;
+  e.category = category;
+  e.start = start - startTime;
+  e.duration = end - start;
+  e.args = args;
+  events.append(e);
+}
+
+void Trace::frameEnded(qint64 time) {
+  if(recording && length && time - startTime >= length) stop();
+}
+
+QString Trace::args(const char * key, const QString & value) {
+  return quote(key) + ":" + quote(value);
+}
+
+QString Trace::args(const char * key1, const QString & value1,
+                    const char * key2, const QString & value2) {
+  return args(key1, value1) + "," + args(key2, value2);
+}
+
+QString Trace::status() {
+  if(!recording) return "Not tracing.";
+  return QString("Tracing to %1: %2 event(s), %3 s recorded")
+    .arg(file).arg(events.size()).arg((Profiler::now() - startTime) / 1e9, 0, 'f', 1);
+}
+
+// Complete ("X") events on one thread, timestamps in microseconds.
+bool Trace::write() {
+  QFile f(file);
+  if(!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+
+  QTextStream out(&f);
+  out.setCodec("UTF-8");
+  out << "{\"traceEvents\":[\n";
+  out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+         "\"args\":{\"name\":\"qrpgengine\"}}";
+  for(int i = 0; i < events.size(); i++) {
+    const Event & e = events[i];
+    out << ",\n{\"name\":" << quote(e.name) << ",\"cat\":" << quote(e.category)
+        << ",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+        << ",\"ts\":" << QString::number(e.start / 1000.0, 'f', 3)
+        << ",\"dur\":" << QString::number(e.duration / 1000.0, 'f', 3)
+        << ",\"args\":{" << e.args << "}}";
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  out.flush();
+  return f.error() == QFile::NoError;
+}
+
+QString Trace::quote(const QString & s) {
+  QString r = "\"";
+  for(int i = 0; i < s.size(); i++) {
+    QChar c = s[i];
+    if(c == '"' || c == '\\') {
+      r += '\\';
+      r += c;
+    } else if(c == '\n') {
+      r += "\\n";
+    } else if(c.unicode() < 0x20) {
+      r += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+    } else {
+      r += c;
+    }
+  }
+  return r + "\"";
+}
@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H 1
+
+#include <QtCore>
+#include "profiler.h"
+
+/* Records timed slices and writes them out in the Chrome trace-event JSON
+   format, for chrome://tracing or ui.perfetto.dev.  Profiler phases are
+   recorded automatically while a trace runs; TraceScope covers work that
+   isn't a phase, like texture uploads, map loads and QML components. */
+
+class Trace {
+public:
+  // Records for the given number of seconds, or until stop() if 0.
+  static void start(int seconds, QString file);
+  // Writes the file.  Returns false if nothing was recording or it failed.
+  static bool stop();
+  static bool isRecording() { return recording; }
+
+  static void slice(const char * name, const char * category,
+                    qint64 start, qint64 end, const QString & args = QString());
+  // Called once per frame to end timed traces.
+  static void frameEnded(qint64 time);
+
+  // Builds the contents of an event's "args" object.
+  static QString args(const char * key, const QString & value);
+  static QString args(const char * key1, const QString & value1,
+                      const char * key2, const QString & value2);
+
+  static QString status();
+
+private:
+  struct Event {
+    const char * name;
+    const char * category;
+    qint64 start, duration;
+    QString args;
+  };
+
+  static bool write();
+  static QString quote(const QString & s);
+
+  enum { MaxEvents = 1000000 };
+
+  static bool recording;
+  static QVector < Event > events;
+  static QString file;
+  static qint64 startTime;
+  static qint64 length;
+  static int dropped;
+};
+
+class TraceScope {
+public:
+  TraceScope(const char * n, const char * c) :
+    name(n), category(c), start(Trace::isRecording() ? Profiler::now() : -1) {}
+  ~TraceScope() { if(start >= 0) Trace::slice(name, category, start, Profiler::now(), args); }
+  void setArgs(const QString & a) { args = a; }
+
+private:
+  const char * name;
+  const char * category;
+  qint64 start;
+  QString args;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <QtCore>
+#include <math.h>
+#include "triggerindex.h"
+#include "entity.h"
+#include "collisiontester.h"
+#include "globals.h"
+
+TriggerIndex::TriggerIndex() {
+}
+
+TriggerIndex::~TriggerIndex() {
+  clear();
+}
+
+void TriggerIndex::insert(Entity * e) {
+  if(triggers.contains(e)) {
+    update(e);
+    return;
+  }
+  if(e->getTriggerIndex()) e->getTriggerIndex()->remove(e);
+
+  triggers.insert(e, QList < Trigger >());
+  e->setTriggerIndex(this);
+  update(e);
+}
+
+// Recomputes the volumes of e's scripts, after it moved or its scripts changed.
+void TriggerIndex::update(Entity * e) {
+  QHash < Entity *, QList < Trigger > >::iterator i = triggers.find(e);
+  if(i == triggers.end()) return;
+
+  removeFromCells(e);
+  i.value().clear();
+
+  for(int s = 0; s < e->getScriptCount(); s++) {
+    int condition = e->getScriptCondition(s);
+    if(condition == ScriptCondition::Enter ||
+       condition == ScriptCondition::Exit ||
+       condition == ScriptCondition::Activate) {
+      Trigger t;
+      t.script = s;
+      e->getTriggerBoundingBox(s, t.x1, t.y1, t.x2, t.y2);
+      i.value().append(t);
+    } else {
+      touching.remove(Key(e, s));
+    }
+  }
+
+  // Scripts that were removed can't be touching anything any more.
+  foreach(Key k, touching) {
+    if(k.first == e && k.second >= e->getScriptCount()) touching.remove(k);
+  }
+
+  addToCells(e);
+}
+
+// Scripts run() marked as triggered but that haven't run yet are dropped too,
+// so they don't fire late when the entity comes back.
+void TriggerIndex::remove(Entity * e) {
+  if(!triggers.contains(e)) return;
+
+  for(int s = 0; s < e->getScriptCount(); s++) {
+    e->getEntityScript(s)->triggered = false;
+  }
+  removeFromCells(e);
+  triggers.remove(e);
+  foreach(Key k, touching) {
+    if(k.first == e) {
+      EntityScript * s = e->getEntityScript(k.second);
+      s->wasTouching = s->isTouching = false;
+      touching.remove(k);
+    }
+  }
+  e->setTriggerIndex(0);
+}
+
+void TriggerIndex::clear() {
+  foreach(Key k, touching) {
+    EntityScript * s = k.first->getEntityScript(k.second);
+    s->wasTouching = s->isTouching = false;
+  }
+
+  QHash < Entity *, QList < Trigger > >::iterator i;
+  for(i = triggers.begin(); i != triggers.end(); ++i) {
+    for(int s = 0; s < i.key()->getScriptCount(); s++) {
+      i.key()->getEntityScript(s)->triggered = false;
+    }
+    i.key()->setTriggerIndex(0);
+  }
+  triggers.clear();
+  cells.clear();
+  touching.clear();
+}
+
+void TriggerIndex::run(double px1, double py1, double px2, double py2, bool activated) {
+  QSet < Key > now;
+  QSet < Entity * > seen;
+  Range r = cellRange(px1, py1, px2, py2);
+
+  for(int cy = r.y1; cy <= r.y2; cy++) {
+    for(int cx = r.x1; cx <= r.x2; cx++) {
+      QHash < qint64, QVector < Entity * > >::const_iterator c = cells.find(key(cx, cy));
+      if(c == cells.end()) continue;
+
+      for(int i = 0; i < c.value().size(); i++) {
+        Entity * e = c.value()[i];
+        if(seen.contains(e)) continue;
+        seen.insert(e);
+
+        const QList < Trigger > & list = triggers[e];
+        for(int j = 0; j < list.size(); j++) {
+          const Trigger & t = list[j];
+          if(!CollisionTester::stationaryTest(t.x1, t.y1, t.x2, t.y2, px1, py1, px2, py2))
+            continue;
+
+          EntityScript * s = e->getEntityScript(t.script);
+          if(s->condition == ScriptCondition::Activate) {
+            if(activated) s->triggered = true;
+          } else {
+            now.insert(Key(e, t.script));
+          }
+        }
+      }
+    }
+  }
+
+  // Only scripts that are touching now or were last frame can change state;
+  // everything else stays not touching.
+  QSet < Key > changed = touching;
+  changed.unite(now);
+  foreach(Key k, changed) {
+    EntityScript * s = k.first->getEntityScript(k.second);
+    s->wasTouching = s->isTouching;
+    s->isTouching = now.contains(k);
+
+    if(s->condition == ScriptCondition::Enter && s->isTouching && !s->wasTouching)
+      s->triggered = true;
+    else if(s->condition == ScriptCondition::Exit && !s->isTouching && s->wasTouching)
+      s->triggered = true;
+  }
+
+  touching = now;
+}
+
+TriggerIndex::Range TriggerIndex::cellRange(double x1, double y1, double x2, double y2) const {
+  Range r;
+  r.x1 = (int) floor(qMin(x1, x2) / CellSize);
+  r.y1 = (int) floor(qMin(y1, y2) / CellSize);
+  r.x2 = (int) floor(qMax(x1, x2) / CellSize);
+  r.y2 = (int) floor(qMax(y1, y2) / CellSize);
+  return r;
+}
+
+void TriggerIndex::addToCells(Entity * e) {
+  const QList < Trigger > & list = triggers[e];
+  for(int i = 0; i < list.size(); i++) {
+    Range r = cellRange(list[i].x1, list[i].y1, list[i].x2, list[i].y2);
+    for(int cy = r.y1; cy <= r.y2; cy++) {
+      for(int cx = r.x1; cx <= r.x2; cx++) {
+        QVector < Entity * > & c = cells[key(cx, cy)];
+        if(!c.contains(e)) c.append(e);
+      }
+    }
+  }
+}
+
+void TriggerIndex::removeFromCells(Entity * e) {
+  const QList < Trigger > & list = triggers[e];
+  for(int i = 0; i < list.size(); i++) {
+    Range r = cellRange(list[i].x1, list[i].y1, list[i].x2, list[i].y2);
+    for(int cy = r.y1; cy <= r.y2; cy++) {
+      for(int cx = r.x1; cx <= r.x2; cx++) {
+        QHash < qint64, QVector < Entity * > >::iterator c = cells.find(key(cx, cy));
+        if(c == cells.end()) continue;
+
+        int j = c.value().indexOf(e);
+        if(j >= 0) c.value().remove(j);
+        if(c.value().isEmpty()) cells.erase(c);
+      }
+    }
+  }
+}
+
+qint64 TriggerIndex::key(int cx, int cy) {
+  return ((qint64) cx << 32) | (quint32) cy;
+}
@@ -0,0 +1,47 @@
+#ifndef TRIGGERINDEX_H
+#define TRIGGERINDEX_H 1
+
+#include <QtCore>
+
+class Entity;
+
+/* Spatial index of the Enter, Exit and Activate script volumes of every
+   entity on a map.  Once per frame it is checked against the player's
+   bounding box and marks which scripts should run; Entity::update then only
+   has to look at the flags. */
+
+class TriggerIndex {
+public:
+  enum { CellSize = 64 };
+
+  TriggerIndex();
+  ~TriggerIndex();
+  void insert(Entity * e);
+  void update(Entity * e);
+  void remove(Entity * e);
+  void clear();
+  void run(double px1, double py1, double px2, double py2, bool activated);
+
+private:
+  struct Trigger {
+    int script;
+    double x1, y1, x2, y2;
+  };
+
+  struct Range {
+    int x1, y1, x2, y2;
+  };
+
+  typedef QPair < Entity *, int > Key;
+
+  Range cellRange(double x1, double y1, double x2, double y2) const;
+  void addToCells(Entity * e);
+  void removeFromCells(Entity * e);
+  static qint64 key(int cx, int cy);
+
+  QHash < Entity *, QList < Trigger > > triggers;
+  QHash < qint64, QVector < Entity * > > cells;
+  QSet < Key > touching;
+};
+
+#endif